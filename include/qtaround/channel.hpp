@@ -0,0 +1,369 @@
+#ifndef _QTAROUND_CHANNEL_HPP_
+#define _QTAROUND_CHANNEL_HPP_
+/**
+ * @file channel.hpp
+ * @brief Bounded multi-producer multi-consumer channels
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace qtaround { namespace mt {
+
+class Select;
+
+namespace detail {
+
+/// notified by channels Select is waiting for
+class ChannelWaiter
+{
+public:
+    ChannelWaiter() : signaled_(false) {}
+
+    void notify();
+    /// @return false on timeout, negative timeout means forever
+    bool wait(long msec);
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool signaled_;
+};
+
+/**
+ * Waiting part of the channel. Waiters are counted, so producers and
+ * consumers touch the mutex only if there is somebody waiting
+ */
+class ChannelBase
+{
+public:
+    ChannelBase();
+    virtual ~ChannelBase() {}
+
+    ChannelBase(ChannelBase const&) = delete;
+    ChannelBase& operator = (ChannelBase const&) = delete;
+
+    void close();
+
+    bool isClosed() const
+    {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+protected:
+    friend class qtaround::mt::Select;
+
+    void addSelect(ChannelWaiter *);
+    void removeSelect(ChannelWaiter *);
+
+    /**
+     * Sleep until try_op() returns true or timeout (negative means
+     * forever) is expired.
+     *
+     * @return false on timeout
+     */
+    bool waitReadable(std::function<bool()> const &try_op, long msec)
+    {
+        return waitFor(readable_, readers_, try_op, msec);
+    }
+
+    bool waitWritable(std::function<bool()> const &try_op, long msec)
+    {
+        return waitFor(writable_, writers_, try_op, msec);
+    }
+
+    void notifyReaders()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (readers_.load(std::memory_order_relaxed))
+            wakeReaders();
+    }
+
+    void notifyWriters()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (writers_.load(std::memory_order_relaxed))
+            wakeWriters();
+    }
+
+private:
+    bool waitFor(std::condition_variable &
+                 , std::atomic<int> &counter
+                 , std::function<bool()> const &try_op
+                 , long msec);
+    void wakeReaders();
+    void wakeWriters();
+
+    std::mutex mutex_;
+    std::condition_variable readable_;
+    std::condition_variable writable_;
+    std::atomic<int> readers_;
+    std::atomic<int> writers_;
+    std::atomic<bool> closed_;
+    std::vector<ChannelWaiter*> selects_;
+};
+
+} // detail
+
+/**
+ * Typed bounded channel, can be used by any number of producers and
+ * consumers. Ring buffer is based on the D.Vyukov bounded MPMC queue:
+ * each cell has a sequence number, so producers and consumers
+ * synchronize only on the cell they are using, and mutex is used only
+ * to sleep if the channel is full/empty.
+ *
+ * After close() sending fails, receivers get all items already
+ * sent and then receive() returns false.
+ */
+template <typename T>
+class Channel : public detail::ChannelBase
+{
+public:
+    /// capacity is rounded up to the power of 2
+    Channel(size_t capacity)
+        : mask_(roundUp(capacity) - 1)
+        , cells_(new Cell[mask_ + 1])
+        , head_(0)
+        , tail_(0)
+    {
+        for (size_t i = 0; i <= mask_; ++i)
+            cells_[i].seq_.store(i, std::memory_order_relaxed);
+    }
+
+    ~Channel()
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        for (auto pos = tail_.load(std::memory_order_relaxed)
+                 ; pos != head; ++pos)
+            cells_[pos & mask_].get()->~T();
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+
+    /// approximate number of queued items
+    size_t size() const
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto head = head_.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    /// value is moved only if it is sent
+    template <typename U>
+    bool trySend(U &&v)
+    {
+        if (isClosed() || !push(std::forward<U>(v)))
+            return false;
+        notifyReaders();
+        return true;
+    }
+
+    /// blocks while channel is full, false if it is closed
+    template <typename U>
+    bool send(U &&v)
+    {
+        return sendFor(std::forward<U>(v), -1);
+    }
+
+    /// false on timeout or if channel is closed
+    template <typename U>
+    bool sendFor(U &&v, long msec)
+    {
+        if (trySend(std::forward<U>(v)))
+            return true;
+        bool is_sent = false;
+        waitWritable([this, &v, &is_sent]() {
+                if (isClosed())
+                    return true;
+                is_sent = push(std::forward<U>(v));
+                return is_sent;
+            }, msec);
+        if (is_sent)
+            notifyReaders();
+        return is_sent;
+    }
+
+    bool tryReceive(T &v)
+    {
+        if (!pop(v))
+            return false;
+        notifyWriters();
+        return true;
+    }
+
+    /// blocks while channel is empty, false if it is closed and empty
+    bool receive(T &v)
+    {
+        return receiveFor(v, -1);
+    }
+
+    /// false on timeout or if channel is closed and empty
+    bool receiveFor(T &v, long msec)
+    {
+        if (tryReceive(v))
+            return true;
+        bool is_received = false;
+        waitReadable([this, &v, &is_received]() {
+                is_received = pop(v);
+                return is_received || isClosed();
+            }, msec);
+        if (!is_received && isClosed())
+            is_received = pop(v);
+        if (is_received)
+            notifyWriters();
+        return is_received;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> seq_;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type data_;
+
+        T *get() { return reinterpret_cast<T*>(&data_); }
+    };
+
+    static size_t roundUp(size_t v)
+    {
+        size_t res = 2;
+        while (res < v)
+            res <<= 1;
+        return res;
+    }
+
+    template <typename U>
+    bool push(U &&v)
+    {
+        auto pos = head_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            auto seq = cell->seq_.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (head_.compare_exchange_weak
+                    (pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+        new (&cell->data_) T(std::forward<U>(v));
+        cell->seq_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T &v)
+    {
+        auto pos = tail_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            auto seq = cell->seq_.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak
+                    (pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+        auto p = cell->get();
+        v = std::move(*p);
+        p->~T();
+        cell->seq_.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    enum { CacheLine = 64 };
+
+    size_t const mask_;
+    std::unique_ptr<Cell[]> cells_;
+    // producers and consumers positions are on separate cache lines
+    alignas(CacheLine) std::atomic<size_t> head_;
+    alignas(CacheLine) std::atomic<size_t> tail_;
+};
+
+/**
+ * Wait for data from several channels:
+ *
+ * @code
+ * mt::Select select;
+ * select.receive(chunks, [](QByteArray data) { ... })
+ *     .receive(records, [](Record r) { ... });
+ * while (select.wait() >= 0) {}
+ * @endcode
+ *
+ * Channels are checked in round-robin order starting from the one
+ * after the last handled, so busy channel does not starve others.
+ */
+class Select
+{
+public:
+    enum Status {
+        Timeout = -1
+        , Closed = -2
+    };
+
+    Select() : next_(0) {}
+
+    Select(Select const&) = delete;
+    Select& operator = (Select const&) = delete;
+
+    /// fn(T) is called by wait() when item is received from channel
+    template <typename T, typename FnT>
+    Select &receive(Channel<T> &channel, FnT fn)
+    {
+        Channel<T> *pchannel = &channel;
+        cases_.push_back(Case{&channel, [pchannel, fn]() mutable {
+                    T v;
+                    if (!pchannel->tryReceive(v))
+                        return false;
+                    fn(std::move(v));
+                    return true;
+                }});
+        return *this;
+    }
+
+    /**
+     * Receive one item from any channel and pass it to the case
+     * handler
+     *
+     * @param msec timeout, negative means forever
+     * @return index of the case handled, Timeout or Closed if all
+     * channels are closed and empty
+     */
+    int wait(long msec = -1);
+
+private:
+    struct Case
+    {
+        detail::ChannelBase *channel;
+        std::function<bool()> tryReceive;
+    };
+
+    int tryOnce();
+
+    std::vector<Case> cases_;
+    size_t next_;
+    detail::ChannelWaiter waiter_;
+};
+
+}}
+
+#endif // _QTAROUND_CHANNEL_HPP_
@@ -0,0 +1,162 @@
+#ifndef _QTAROUND_CORO_HPP_
+#define _QTAROUND_CORO_HPP_
+/**
+ * @file coro.hpp
+ * @brief C++20 coroutines support
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ *
+ * If compiler supports coroutines mt::Future<T> can be awaited and
+ * used as a coroutine return type, so actor asks, subprocess::run_async
+ * results and mt::after() timers can be co_await-ed:
+ *
+ * @code
+ * mt::Future<int> workflow(mt::ActorHandle storage)
+ * {
+ *     auto res = co_await subprocess::run_async("df", {"-P"});
+ *     co_await mt::after(100);
+ *     co_return co_await storage->ask<Storage>([res](Storage *s) {
+ *             return s->update(res.stdout);
+ *         });
+ * }
+ * @endcode
+ *
+ * Suspended coroutine is resumed in the context it was suspended in
+ * (see mt::currentInvoker()): by the same actor when called from the
+ * actor message handler or by the main thread event loop. Awaiting a
+ * future that is not ready in other threads raises an error. If the
+ * actor is finished meanwhile the coroutine is destroyed and its
+ * future is failed.
+ *
+ * Coroutines are available in C++20 mode only (-std=c++2a, plus
+ * -fcoroutines for gcc 10), qtaround itself is built as C++11.
+ */
+
+#include <qtaround/mt.hpp>
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+
+#define QTAROUND_HAS_COROUTINES 1
+
+namespace qtaround { namespace mt {
+
+namespace detail {
+
+template <typename T>
+class CoroPromiseBase
+{
+public:
+    Future<T> get_return_object() { return promise_.future(); }
+
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+
+    void unhandled_exception()
+    {
+        promise_.setError(std::current_exception());
+    }
+
+protected:
+    Promise<T> promise_;
+};
+
+template <typename T>
+class CoroPromise : public CoroPromiseBase<T>
+{
+public:
+    void return_value(T v) { this->promise_.setValue(std::move(v)); }
+};
+
+template <>
+class CoroPromise<void> : public CoroPromiseBase<void>
+{
+public:
+    void return_void() { promise_.setValue(); }
+};
+
+/**
+ * Owns suspended coroutine until it is resumed: coroutine is destroyed
+ * if the function resuming it is dropped, e.g. by the finished actor
+ */
+class SuspendedCoro
+{
+public:
+    SuspendedCoro(std::coroutine_handle<> h) : h_(h) {}
+
+    ~SuspendedCoro()
+    {
+        if (h_)
+            h_.destroy();
+    }
+
+    SuspendedCoro(SuspendedCoro const&) = delete;
+    SuspendedCoro& operator = (SuspendedCoro const&) = delete;
+
+    void resume()
+    {
+        auto h = h_;
+        h_ = nullptr;
+        h.resume();
+    }
+
+private:
+    std::coroutine_handle<> h_;
+};
+
+template <typename T>
+class FutureAwaiter
+{
+public:
+    FutureAwaiter(Future<T> f) : future_(std::move(f)) {}
+
+    bool await_ready() const { return future_.isReady(); }
+
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        // otherwise coroutine would be resumed by the thread resolving
+        // the future, e.g. by the timer thread
+        auto invoke = currentInvoker(false);
+        if (!invoke)
+            error::raise({{"msg", "Coroutine can be suspended only by actor"
+                            " or main thread"}});
+        auto coro = std::make_shared<SuspendedCoro>(h);
+        // continuation can be executed right here if the future is
+        // resolved meanwhile, resumed coroutine can finish and free
+        // this awaiter
+        auto future = future_;
+        future.then([coro, invoke](Future<T>) {
+                invoke([coro]() { coro->resume(); });
+            });
+    }
+
+    T await_resume() { return future_.get(); }
+
+private:
+    Future<T> future_;
+};
+
+} // detail
+
+template <typename T>
+detail::FutureAwaiter<T> operator co_await(Future<T> f)
+{
+    return detail::FutureAwaiter<T>(std::move(f));
+}
+
+}}
+
+namespace std {
+
+template <typename T, typename ... ArgsT>
+struct coroutine_traits<qtaround::mt::Future<T>, ArgsT...>
+{
+    typedef qtaround::mt::detail::CoroPromise<T> promise_type;
+};
+
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif // _QTAROUND_CORO_HPP_
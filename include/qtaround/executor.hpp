@@ -0,0 +1,197 @@
+#ifndef _QTAROUND_EXECUTOR_HPP_
+#define _QTAROUND_EXECUTOR_HPP_
+/**
+ * @file executor.hpp
+ * @brief Work-stealing thread pool
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <qtaround/future.hpp>
+
+#include <QVariantMap>
+
+#include <functional>
+#include <initializer_list>
+#include <memory>
+
+namespace qtaround { namespace mt {
+
+class ExecutorImpl;
+
+/**
+ * Thread pool with per-worker task deques. Tasks submitted from a
+ * worker go to its own deque and are executed in LIFO order (better
+ * cache locality), idle workers steal the oldest tasks from other
+ * workers. Tasks submitted from other threads go to the shared
+ * queue.
+ */
+class Executor
+{
+public:
+    typedef std::function<void()> task_type;
+
+    /**
+     * Options:
+     * - threads: number of workers, ideal thread count (at least
+     *   2) by default
+     */
+    Executor(QVariantMap const &options = QVariantMap());
+    ~Executor();
+
+    Executor(Executor const&) = delete;
+    Executor& operator = (Executor const&) = delete;
+
+    /// process-wide executor, also used to run pooled actors
+    static Executor &global();
+
+    size_t size() const;
+
+    /// exception thrown by the task is logged and ignored
+    void execute(task_type);
+
+    /**
+     * The same as execute() but if it is called from the worker the
+     * task is executed after other tasks queued by this worker. Use
+     * it to requeue long jobs in portions
+     */
+    void defer(task_type);
+
+    /**
+     * Execute one queued task in the calling worker if there is
+     * any. Used to help other workers while waiting for results. Does
+     * nothing if it is called by other threads: queued tasks include
+     * pooled actors mailboxes, they should not be processed by the
+     * caller thread
+     *
+     * @return false if there was nothing to execute
+     */
+    bool tryRunOne();
+
+    /// fn() is executed by the worker, result is passed to the future
+    template <typename FnT>
+    Future<typename std::result_of<FnT()>::type> submit(FnT fn)
+    {
+        typedef typename std::result_of<FnT()>::type R;
+        Promise<R> p;
+        execute([p, fn]() mutable {
+                if (!p.isCanceled())
+                    detail::Fulfill<R>::apply(p, fn);
+            });
+        return p.future();
+    }
+
+    /**
+     * Execute fn(i) for each i in [begin, end), range is split into
+     * chunks of grain size (calculated from the pool size if 0).
+     * Calling thread participates, function returns when all chunks
+     * are processed and rethrows the first exception thrown by fn
+     */
+    void parallel_for(size_t begin, size_t end
+                      , std::function<void(size_t)> const &fn
+                      , size_t grain = 0);
+
+private:
+    std::unique_ptr<ExecutorImpl> impl_;
+};
+
+/**
+ * Scoped group of tasks: wait() (also called by destructor) returns
+ * when all tasks started by run() are finished, executing not yet
+ * started tasks of the group meanwhile. Groups can be nested.
+ */
+class TaskGroup
+{
+public:
+    TaskGroup(Executor &executor = Executor::global());
+    ~TaskGroup();
+
+    TaskGroup(TaskGroup const&) = delete;
+    TaskGroup& operator = (TaskGroup const&) = delete;
+
+    void run(Executor::task_type);
+
+    /// rethrows the first exception thrown by tasks
+    void wait();
+
+private:
+    class State;
+
+    void join();
+
+    Executor &executor_;
+    std::shared_ptr<State> state_;
+};
+
+/**
+ * Graph of dependent tasks executed by the executor with maximum
+ * parallelism: task is started as soon as all tasks it depends on
+ * are finished.
+ *
+ * If task fails or is canceled all tasks depending on it
+ * (transitively) are canceled, independent tasks are still
+ * executed. Running tasks are not interrupted.
+ *
+ * @code
+ * mt::TaskGraph graph;
+ * auto a = graph.add("unit_a", backup_a);
+ * auto b = graph.add("unit_b", backup_b);
+ * auto archive = graph.add("archive", make_archive);
+ * graph.depends(b, a);
+ * graph.depends(archive, {a, b});
+ * graph.run().get();
+ * @endcode
+ */
+class TaskGraph
+{
+public:
+    typedef size_t task_id;
+
+    TaskGraph(Executor &executor = Executor::global());
+    /// waits for running tasks, pending ones are canceled
+    ~TaskGraph();
+
+    TaskGraph(TaskGraph const&) = delete;
+    TaskGraph& operator = (TaskGraph const&) = delete;
+
+    task_id add(QString const &name, Executor::task_type);
+
+    /// task is started after all tasks from deps are finished
+    void depends(task_id task, task_id dep);
+    void depends(task_id task, std::initializer_list<task_id> deps);
+
+    /**
+     * Start execution, graph can be run only once. Raises error if
+     * there is a dependency cycle.
+     *
+     * @return future resolved when all tasks are finished or
+     * canceled, with the first task error if any. Canceling it
+     * cancels the whole graph
+     */
+    Future<void> run();
+
+    /// cancel task (and tasks depending on it) if it is not started yet
+    void cancel(task_id);
+    /// cancel all not started tasks
+    void cancel();
+
+    /**
+     * Per-task information, list (ordered by task id) of maps:
+     * - name
+     * - state: pending, running, done, failed or canceled
+     * - start_ms: time since graph start
+     * - duration_ms: execution time
+     * - error: error message if task failed
+     */
+    QVariantList stats() const;
+
+private:
+    class State;
+
+    Executor &executor_;
+    std::shared_ptr<State> state_;
+};
+
+}}
+
+#endif // _QTAROUND_EXECUTOR_HPP_
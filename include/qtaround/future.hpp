@@ -0,0 +1,455 @@
+#ifndef _QTAROUND_FUTURE_HPP_
+#define _QTAROUND_FUTURE_HPP_
+/**
+ * @file future.hpp
+ * @brief Future/promise with continuations and cancellation
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <qtaround/error.hpp>
+
+#include <QObject>
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <type_traits>
+
+namespace qtaround { namespace mt {
+
+/**
+ * Execute fn in the thread context object belongs to. fn is not
+ * executed if context is destroyed before
+ */
+void invokeLater(QObject *context, std::function<void()> fn);
+
+template <typename T> class Future;
+template <typename T> class Promise;
+
+namespace detail {
+
+class StateBase
+{
+public:
+    StateBase() : ready_(false), canceled_(false) {}
+    virtual ~StateBase() {}
+
+    bool isReady() const
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        return ready_;
+    }
+
+    bool isCanceled() const
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        return canceled_;
+    }
+
+    void wait() const
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        cond_.wait(l, [this]() { return ready_; });
+    }
+
+    bool waitFor(long msec) const
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        return cond_.wait_for(l, std::chrono::milliseconds(msec)
+                              , [this]() { return ready_; });
+    }
+
+    void rethrowIfError() const
+    {
+        if (error_)
+            std::rethrow_exception(error_);
+    }
+
+    /// continuation is executed immediately if state is ready
+    void addContinuation(std::function<void()> fn)
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        if (!ready_) {
+            continuations_.push_back(std::move(fn));
+            return;
+        }
+        l.unlock();
+        fn();
+    }
+
+    void setOnCancel(std::function<void()> fn)
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        if (!canceled_) {
+            onCancel_ = std::move(fn);
+            return;
+        }
+        l.unlock();
+        fn();
+    }
+
+    bool cancel()
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        if (ready_ || canceled_)
+            return false;
+        canceled_ = true;
+        auto fn = std::move(onCancel_);
+        l.unlock();
+        if (fn)
+            fn();
+        setError(std::make_exception_ptr(error::Error({{"msg", "Canceled"}})));
+        return true;
+    }
+
+    bool setError(std::exception_ptr e)
+    {
+        return complete([this, e]() { error_ = e; });
+    }
+
+protected:
+    template <typename FnT>
+    bool complete(FnT set)
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        if (ready_)
+            return false;
+        set();
+        ready_ = true;
+        auto continuations = std::move(continuations_);
+        onCancel_ = nullptr;
+        cond_.notify_all();
+        l.unlock();
+        for (auto &fn : continuations)
+            fn();
+        return true;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    mutable std::condition_variable cond_;
+    bool ready_;
+    bool canceled_;
+    std::exception_ptr error_;
+    std::vector<std::function<void()> > continuations_;
+    std::function<void()> onCancel_;
+};
+
+template <typename T>
+class State : public StateBase
+{
+public:
+    bool setValue(T &&v)
+    {
+        return complete([this, &v]() { value_.reset(new T(std::move(v))); });
+    }
+
+    T get() const
+    {
+        wait();
+        rethrowIfError();
+        return *value_;
+    }
+
+private:
+    std::unique_ptr<T> value_;
+};
+
+template <>
+class State<void> : public StateBase
+{
+public:
+    bool setValue()
+    {
+        return complete([]() {});
+    }
+
+    void get() const
+    {
+        wait();
+        rethrowIfError();
+    }
+};
+
+template <typename R>
+struct Fulfill
+{
+    template <typename FnT, typename ... ArgsT>
+    static void apply(Promise<R> &p, FnT &fn, ArgsT&& ... args)
+    {
+        try {
+            p.setValue(fn(std::forward<ArgsT>(args)...));
+        } catch (...) {
+            p.setError(std::current_exception());
+        }
+    }
+};
+
+template <>
+struct Fulfill<void>
+{
+    template <typename FnT, typename ... ArgsT>
+    static void apply(Promise<void> &p, FnT &fn, ArgsT&& ... args)
+    {
+        try {
+            fn(std::forward<ArgsT>(args)...);
+            p.setValue();
+        } catch (...) {
+            p.setError(std::current_exception());
+        }
+    }
+};
+
+template <typename T>
+class FutureBase
+{
+public:
+    FutureBase() {}
+    FutureBase(std::shared_ptr<State<T> > const &state) : state_(state) {}
+
+    bool valid() const { return !!state_; }
+    bool isReady() const { return state_->isReady(); }
+    bool isCanceled() const { return state_->isCanceled(); }
+    void wait() const { state_->wait(); }
+    bool waitFor(long msec) const { return state_->waitFor(msec); }
+
+    /**
+     * Cancel pending operation: producer is notified, future is
+     * resolved with "Canceled" error
+     */
+    bool cancel() const { return state_->cancel(); }
+
+    /**
+     * Execute fn(Future<T>) when this future is ready. fn is executed
+     * in the thread resolving the future (or immediately if it is
+     * ready). Canceling returned future cancels this one.
+     *
+     * Continuation refers to this state weakly, so pending state is
+     * kept alive only by its promise and futures, not by chained
+     * continuations. If the last promise is destroyed, state is
+     * resolved with "Broken promise" error and continuations are
+     * released.
+     */
+    template <typename FnT>
+    Future<typename std::result_of<FnT(Future<T>)>::type> then(FnT fn) const
+    {
+        typedef typename std::result_of<FnT(Future<T>)>::type R;
+        Promise<R> p;
+        std::weak_ptr<State<T> > weak_self(state_);
+        p.onCancel([weak_self]() { cancelState(weak_self); });
+        state_->addContinuation([p, fn, weak_self]() mutable {
+                Future<T> self(weak_self.lock());
+                Fulfill<R>::apply(p, fn, self);
+            });
+        return p.future();
+    }
+
+    /**
+     * The same as then(fn) but fn is executed in the thread context
+     * belongs to. Context thread should have running event loop
+     */
+    template <typename FnT>
+    Future<typename std::result_of<FnT(Future<T>)>::type>
+    then(QObject *context, FnT fn) const
+    {
+        typedef typename std::result_of<FnT(Future<T>)>::type R;
+        Promise<R> p;
+        std::weak_ptr<State<T> > weak_self(state_);
+        p.onCancel([weak_self]() { cancelState(weak_self); });
+        state_->addContinuation([context, p, fn, weak_self]() {
+                Future<T> self(weak_self.lock());
+                invokeLater(context, [p, fn, self]() mutable {
+                        Fulfill<R>::apply(p, fn, self);
+                    });
+            });
+        return p.future();
+    }
+
+protected:
+    static void cancelState(std::weak_ptr<State<T> > const &weak)
+    {
+        auto state = weak.lock();
+        if (state)
+            state->cancel();
+    }
+
+    std::shared_ptr<State<T> > state_;
+};
+
+/**
+ * Shared by copies of the promise: when the last copy is destroyed
+ * unresolved, waiters get "Broken promise" error instead of hanging
+ */
+template <typename T>
+class PromiseGuard
+{
+public:
+    PromiseGuard(std::shared_ptr<State<T> > const &state) : state_(state) {}
+
+    ~PromiseGuard()
+    {
+        if (state_->isReady())
+            return;
+        // producer can drop the promise from the cancel handler
+        auto msg = state_->isCanceled() ? "Canceled" : "Broken promise";
+        state_->setError(std::make_exception_ptr(error::Error({{"msg", msg}})));
+    }
+
+private:
+    std::shared_ptr<State<T> > state_;
+};
+
+template <typename T>
+class PromiseBase
+{
+public:
+    PromiseBase()
+        : state_(std::make_shared<State<T> >())
+        , guard_(std::make_shared<PromiseGuard<T> >(state_))
+    {}
+
+    Future<T> future() const { return Future<T>(state_); }
+
+    bool setError(std::exception_ptr e) const { return state_->setError(e); }
+
+    bool setError(QVariantMap const &info) const
+    {
+        return setError(std::make_exception_ptr(error::Error(info)));
+    }
+
+    bool isCanceled() const { return state_->isCanceled(); }
+
+    /// fn is called when future is canceled, in the canceling thread
+    void onCancel(std::function<void()> fn) const
+    {
+        state_->setOnCancel(std::move(fn));
+    }
+
+protected:
+    std::shared_ptr<State<T> > state_;
+
+private:
+    std::shared_ptr<PromiseGuard<T> > guard_;
+};
+
+} // detail
+
+template <typename T>
+class Future : public detail::FutureBase<T>
+{
+public:
+    Future() {}
+    Future(std::shared_ptr<detail::State<T> > const &state)
+        : detail::FutureBase<T>(state) {}
+
+    /// wait for result, rethrows error if failed
+    T get() const { return this->state_->get(); }
+};
+
+template <>
+class Future<void> : public detail::FutureBase<void>
+{
+public:
+    Future() {}
+    Future(std::shared_ptr<detail::State<void> > const &state)
+        : detail::FutureBase<void>(state) {}
+
+    void get() const { state_->get(); }
+};
+
+template <typename T>
+class Promise : public detail::PromiseBase<T>
+{
+public:
+    using detail::PromiseBase<T>::setError;
+
+    bool setValue(T v) const { return this->state_->setValue(std::move(v)); }
+};
+
+template <>
+class Promise<void> : public detail::PromiseBase<void>
+{
+public:
+    using detail::PromiseBase<void>::setError;
+
+    bool setValue() const { return state_->setValue(); }
+};
+
+template <typename T>
+Future<T> makeReadyFuture(T v)
+{
+    Promise<T> p;
+    p.setValue(std::move(v));
+    return p.future();
+}
+
+namespace detail {
+
+template <typename R, typename T, typename FnT>
+Future<R> whenAll(std::vector<Future<T> > const &futures, FnT done)
+{
+    Promise<R> p;
+    if (futures.empty()) {
+        done(p, futures);
+        return p.future();
+    }
+    p.onCancel([futures]() {
+            for (auto &f : futures)
+                f.cancel();
+        });
+    auto left = std::make_shared<std::atomic<size_t> >(futures.size());
+    for (auto &f : futures) {
+        f.then([p, futures, left, done](Future<T> f) {
+                try {
+                    f.get();
+                } catch (...) {
+                    p.setError(std::current_exception());
+                    return;
+                }
+                if (--*left == 0)
+                    done(p, futures);
+            });
+    }
+    return p.future();
+}
+
+}
+
+/**
+ * Resolved with all results (in the same order) when all futures
+ * are resolved or with the first error. Canceling returned future
+ * cancels all of them
+ */
+template <typename T>
+Future<std::vector<T> > when_all(std::vector<Future<T> > const &futures)
+{
+    typedef std::vector<T> R;
+    return detail::whenAll<R>
+        (futures, [](Promise<R> const &p
+                     , std::vector<Future<T> > const &futures) {
+            R res;
+            res.reserve(futures.size());
+            for (auto &f : futures)
+                res.push_back(f.get());
+            p.setValue(std::move(res));
+        });
+}
+
+inline Future<void> when_all(std::vector<Future<void> > const &futures)
+{
+    return detail::whenAll<void>
+        (futures, [](Promise<void> const &p
+                     , std::vector<Future<void> > const &) {
+            p.setValue();
+        });
+}
+
+}}
+
+#endif // _QTAROUND_FUTURE_HPP_
@@ -8,9 +8,13 @@
  */
 
 #include <qtaround/util.hpp>
+#include <qtaround/future.hpp>
 #include <QThread>
 #include <QCoreApplication>
 
+#include <atomic>
+#include <memory>
+
 namespace qtaround { namespace mt {
 
 class Actor;
@@ -20,6 +24,108 @@ typedef std::function<UNIQUE_PTR(QObject) ()> qobj_ctor_type;
 typedef std::function<void (ActorHandle)> actor_callback_type;
 
 class ActorImpl;
+class Mailbox;
+
+/**
+ * Message delivered to the actor object in the actor thread. It is
+ * also a node of the actor lock-free mailbox queue, so posting does
+ * not take locks and does not allocate anything except the message
+ * itself
+ */
+class Message
+{
+public:
+    Message() : next_(nullptr), enqueued_(0) {}
+    virtual ~Message() {}
+
+    /// called in the actor thread
+    virtual void deliver(QObject *) = 0;
+
+    /**
+     * Coalescing key: in the batch mode only the newest message with
+     * the same non-empty key is delivered from the batch
+     */
+    QString const &key() const { return key_; }
+    void setKey(QString const &key) { key_ = key; }
+
+private:
+    friend class Mailbox;
+    friend class Dispatcher;
+    std::atomic<Message*> next_;
+    QString key_;
+    qint64 enqueued_;
+};
+
+/**
+ * Actor object can implement it to receive messages in batches (see
+ * "batch" actor option). Otherwise batched messages are delivered one
+ * by one
+ */
+class BatchHandler
+{
+public:
+    virtual ~BatchHandler() {}
+
+    /**
+     * Messages are owned by the actor and deleted after the call,
+     * handler can call Message::deliver() for messages it does not
+     * recognize
+     */
+    virtual void handleBatch(Message * const *messages, size_t count) = 0;
+};
+
+template <typename T, typename FnT>
+class FnMessage : public Message
+{
+public:
+    FnMessage(FnT &&fn) : fn_(std::move(fn)) {}
+    FnMessage(FnT const &fn) : fn_(fn) {}
+
+    void deliver(QObject *obj)
+    {
+        fn_(static_cast<T*>(obj));
+    }
+
+private:
+    FnT fn_;
+};
+
+namespace detail {
+
+/**
+ * Shared by copies of the ask() message: if the message is destroyed
+ * without being delivered (rejected or left in the mailbox of the
+ * finished actor) the request fails
+ */
+template <typename R>
+class AskRequest
+{
+public:
+    AskRequest(Promise<R> const &p) : promise_(p), isExecuted_(false) {}
+
+    ~AskRequest()
+    {
+        if (!isExecuted_)
+            promise_.setError({{"msg", "Actor is not running"}});
+    }
+
+    AskRequest(AskRequest const&) = delete;
+    AskRequest& operator = (AskRequest const&) = delete;
+
+    template <typename FnT, typename T>
+    void execute(FnT &fn, T *obj)
+    {
+        isExecuted_ = true;
+        if (!promise_.isCanceled())
+            Fulfill<R>::apply(promise_, fn, obj);
+    }
+
+private:
+    Promise<R> promise_;
+    bool isExecuted_;
+};
+
+}
 
 class Actor : public QObject
 {
@@ -31,23 +137,164 @@ public:
     Actor(Actor const&) = delete;
     Actor& operator = (Actor const&) = delete;
 
+    /**
+     * Options:
+     * - pool: if true actor does not own a thread, its mailbox is
+     *   processed by Executor::global() workers, at most one worker
+     *   at a time. Object is constructed by a pool worker and has no
+     *   thread affinity, so it only receives messages and events
+     *   passed through the actor (no timers, queued connections
+     *   etc.)
+     * - capacity: mailbox size limit, unbounded by default
+     * - overflow: what to do if mailbox is full: "block" (default)
+     *   the producer, "fail" posting or "drop_oldest" queued
+     *   message. Actor posting to itself is never blocked
+     * - high_water, low_water: mailbox size thresholds for
+     *   highWater/lowWater signals, capacity and half of high_water
+     *   by default
+     * - batch: maximum number of messages taken from the mailbox at
+     *   once and passed to BatchHandler, messages with the same key
+     *   are coalesced inside the batch
+     * - metrics: collect runtime metrics, see metrics()
+     * - metrics_dump: interval (msec) to dump metrics to the debug
+     *   log, turns metrics on
+     *
+     * Actor thread options (not supported by pooled actors):
+     * - name: thread name shown by top/perf, truncated to 15 chars
+     * - cpus: CPU affinity, list of CPU indexes
+     * - nice: thread nice value
+     * - sched: scheduling policy, "other" (default), "batch" or "idle"
+     * - io_class: I/O scheduling class, "realtime", "best_effort" or
+     *   "idle"
+     * - io_priority: priority inside I/O class, 0 (highest) - 7, 4
+     *   by default
+     *
+     * Invalid thread options are reported as errors, failure to apply
+     * them (e.g. no permission to raise priority) is logged
+     */
     static void create(qobj_ctor_type
                        , actor_callback_type
-                       , QObject *parent = nullptr);
+                       , QObject *parent = nullptr
+                       , QVariantMap const &options = QVariantMap());
 
     static ActorHandle createSync
-    (qobj_ctor_type, QObject *parent = nullptr);
+    (qobj_ctor_type, QObject *parent = nullptr
+     , QVariantMap const &options = QVariantMap());
 
+    /// event is passed through the mailbox and sent to the object
     bool postEvent(QEvent *);
     bool sendEvent(QEvent *);
+
+    bool postMessage(std::unique_ptr<Message>);
+
+    /**
+     * fn(T*) is executed in the actor thread, T should be the type
+     * of the actor object
+     */
+    template <typename T, typename FnT>
+    bool post(FnT fn)
+    {
+        typedef typename std::decay<FnT>::type fn_type;
+        return postMessage(std::unique_ptr<Message>
+                           (new FnMessage<T, fn_type>(std::move(fn))));
+    }
+
+    /// the same as post(fn) but message has coalescing key
+    template <typename T, typename FnT>
+    bool post(QString const &key, FnT fn)
+    {
+        typedef typename std::decay<FnT>::type fn_type;
+        std::unique_ptr<Message> m(new FnMessage<T, fn_type>(std::move(fn)));
+        m->setKey(key);
+        return postMessage(std::move(m));
+    }
+
+    /**
+     * Request/response: fn(T*) is executed in the actor thread, the
+     * returned future is resolved with its result or exception. Use
+     * Future::then(context, ...) to get the result in the caller
+     * event loop. If the future is canceled before the message is
+     * processed fn is not executed. If the message is not delivered
+     * (actor is finished) the future fails with "Actor is not
+     * running"
+     */
+    template <typename T, typename FnT>
+    Future<typename std::result_of<FnT(T*)>::type> ask(FnT fn)
+    {
+        typedef typename std::result_of<FnT(T*)>::type R;
+        Promise<R> p;
+        auto request = std::make_shared<detail::AskRequest<R> >(p);
+        post<T>([request, fn](T *obj) mutable {
+                request->execute(fn, obj);
+            });
+        return p.future();
+    }
+
+    /**
+     * fn(T*) is posted to the actor after msec. Timers are served by
+     * the shared timer wheel, they do not create QObjects. Timer
+     * thread is never blocked: if the bounded mailbox is full the
+     * message is dropped (see "dropped" metric), periodic timer keeps
+     * running.
+     *
+     * @return timer id to be used with cancelTimer()
+     */
+    template <typename T, typename FnT>
+    quint64 postDelayed(unsigned long msec, FnT fn)
+    {
+        return scheduleMessage(msec, 0, [fn](QObject *obj) {
+                fn(static_cast<T*>(obj));
+            });
+    }
+
+    /// fn(T*) is posted to the actor each period msec until canceled
+    template <typename T, typename FnT>
+    quint64 postPeriodic(unsigned long period, FnT fn)
+    {
+        return scheduleMessage(period, period, [fn](QObject *obj) {
+                fn(static_cast<T*>(obj));
+            });
+    }
+
+    /**
+     * Timers are also stopped when actor is finished. Message
+     * already posted by the timer is not canceled
+     */
+    bool cancelTimer(quint64 id);
+
+    quint64 scheduleMessage(unsigned long msec, unsigned long period
+                            , std::function<void(QObject*)>);
+
+    /**
+     * Messages still queued when the actor is finished are deleted
+     * without delivery and counted as "undelivered" (pooled actor
+     * delivers all messages posted before the quit request). Posting
+     * to the finished actor fails
+     */
     void quit();
     bool quitSync(unsigned long timeout);
 
+    /**
+     * Mailbox depth and overflow counters are always available,
+     * "dropped" includes timer messages not fitting into the full
+     * mailbox, "undelivered" counts messages left in the mailbox when
+     * the actor finished. If
+     * metrics are turned on there are also message latency (from
+     * posting to processing) and handler run time histograms (log2
+     * buckets in usec) and the share of time actor was busy
+     */
+    QVariantMap metrics() const;
+
 signals:
     void finished(Actor*);
+    /// mailbox size reached high water mark, emitted by the producer
+    void highWater(Actor*);
+    /// mailbox size is back at low water mark, emitted by the actor
+    void lowWater(Actor*);
 
 private:
     friend class ActorImpl;
+    friend class AppExitMonitor;
     ActorImpl *impl_;
 };
 
@@ -56,26 +303,134 @@ void startActor
 (std::function<UNIQUE_PTR(T) ()> ctor
  , actor_callback_type cb
  , QObject *parent = nullptr
+ , QVariantMap const &options = QVariantMap()
  , typename std::enable_if<std::is_convertible<T*, QObject*>::value>::type* = 0)
 {
     auto qobj_ctor = [ctor]() {
         return static_cast_qobject_unique<QObject>(ctor());
     };
-    Actor::create(qobj_ctor, cb, parent);
+    Actor::create(qobj_ctor, cb, parent, options);
 }
 
 template <typename T>
 ActorHandle startActorSync
 (std::function<UNIQUE_PTR(T) ()> ctor, QObject *parent = nullptr
+ , QVariantMap const &options = QVariantMap()
+ , typename std::enable_if<std::is_convertible<T*, QObject*>::value>::type* = 0)
+{
+    auto qobj_ctor = [ctor]() {
+        return static_cast_qobject_unique<QObject>(ctor());
+    };
+    return Actor::createSync(qobj_ctor, parent, options);
+}
+
+/**
+ * Group of actors (shards) created with the same constructor. Messages
+ * are routed by the key hash, so messages with the same key are
+ * handled by the same actor in order while different keys are handled
+ * in parallel.
+ */
+class ActorGroup
+{
+public:
+    /**
+     * Options are passed to actors, also:
+     * - size: number of shards, ideal thread count by default
+     * - hot_factor: shard is reported as hot if it got more than
+     *   hot_factor times the average number of messages, 2 by default
+     * - name: shard threads are named <name>-<shard index>
+     */
+    ActorGroup(qobj_ctor_type, QVariantMap const &options = QVariantMap());
+    ~ActorGroup();
+
+    ActorGroup(ActorGroup const&) = delete;
+    ActorGroup& operator = (ActorGroup const&) = delete;
+
+    size_t size() const { return actors_.size(); }
+    size_t shardIndex(QString const &key) const;
+    ActorHandle const &shard(size_t index) const { return actors_[index]; }
+
+    template <typename T, typename FnT>
+    bool post(QString const &key, FnT fn)
+    {
+        return route(key)->template post<T>(std::move(fn));
+    }
+
+    template <typename T, typename FnT>
+    Future<typename std::result_of<FnT(T*)>::type> ask
+    (QString const &key, FnT fn)
+    {
+        return route(key)->template ask<T>(std::move(fn));
+    }
+
+    /// shards got more messages than hot_factor * average
+    std::vector<size_t> hotShards() const;
+
+    /**
+     * Per-shard statistics: "shards" is a list of maps with
+     * "messages" routed to the shard and the current mailbox
+     * "depth", "hot" is a list of hot shard indexes
+     */
+    QVariantMap stats() const;
+
+    void resetStats();
+
+    void quit();
+    bool quitSync(unsigned long timeout);
+
+private:
+    ActorHandle const &route(QString const &key);
+
+    std::vector<ActorHandle> actors_;
+    std::unique_ptr<std::atomic<quint64>[]> counts_;
+    double hotFactor_;
+};
+
+template <typename T>
+std::unique_ptr<ActorGroup> startActorGroup
+(std::function<UNIQUE_PTR(T) ()> ctor
+ , QVariantMap const &options = QVariantMap()
  , typename std::enable_if<std::is_convertible<T*, QObject*>::value>::type* = 0)
 {
     auto qobj_ctor = [ctor]() {
         return static_cast_qobject_unique<QObject>(ctor());
     };
-    return Actor::createSync(qobj_ctor, parent);
+    return std::unique_ptr<ActorGroup>(new ActorGroup(qobj_ctor, options));
 }
 
+typedef std::function<void(std::function<void()>)> invoker_type;
+
+/**
+ * Returns function executing passed functions in the current context:
+ * through the mailbox of the actor handling message in this thread,
+ * in the application event loop if it is the main thread, or
+ * immediately otherwise. Functions are dropped if the actor is
+ * finished
+ *
+ * @param can_run_inline if false and there is no actor or event loop
+ * context, empty function is returned
+ */
+invoker_type currentInvoker(bool can_run_inline = true);
+
+/**
+ * Future resolved after msec by the timer wheel thread, canceling it
+ * cancels the timer
+ */
+Future<void> after(unsigned long msec);
+
+/**
+ * On application exit all registered actors are asked to quit at once
+ * and waited for under the single deadline (see setShutdownTimeout)
+ */
 void deleteOnApplicationExit(ActorHandle);
+
+/**
+ * Total time to wait for actors on application exit, 5 s by
+ * default. Actors missed the deadline are reported and not waited
+ * again on destruction. It is also the time actor destructor waits
+ * for its thread to quit
+ */
+void setShutdownTimeout(unsigned long msec);
 }}
 
 #endif // _QTAROUND_MT_HPP_
@@ -130,6 +130,11 @@ bool isDescendent(QString const &p, QString const &other);
 
 int system(QString const &cmd, QStringList const &args = QStringList());
 
+/// see subprocess::run_async
+mt::Future<int> system_async(QString const &cmd
+                             , QStringList const &args = QStringList()
+                             , QVariantMap const &options = QVariantMap());
+
 bool mkdir(QString const &path, QVariantMap const &options);
 
 static inline bool mkdir(QString const &path)
@@ -222,6 +227,12 @@ int cptree(QString const &src, QString const &dst
 
 size_t get_block_size(QString const &);
 
+/**
+ * Probe functions below execute commands on each call, only
+ * idempotent probes (mountpoint, stat with "cache" option) are
+ * memoized in subprocess::Cache
+ */
+
 QList<QVariantMap> mount();
 QString mountpoint(QString const &path);
 string_map_type stat(QString const &path, QVariantMap &&options = QVariantMap());
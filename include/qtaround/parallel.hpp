@@ -0,0 +1,159 @@
+#ifndef _QTAROUND_PARALLEL_HPP_
+#define _QTAROUND_PARALLEL_HPP_
+/**
+ * @file parallel.hpp
+ * @brief Parallel variants of util::map and friends
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ *
+ * Input is split into chunks processed by executor workers (calling
+ * thread participates), results are collected in the input order.
+ * Small inputs (not larger than one chunk) are processed in the
+ * calling thread. The first exception thrown by the function is
+ * rethrown.
+ */
+
+#include <qtaround/executor.hpp>
+#include <qtaround/util.hpp>
+
+#include <QList>
+
+#include <algorithm>
+#include <vector>
+
+namespace qtaround { namespace util {
+
+namespace detail {
+
+/// grain 0: split input to 4 chunks per worker, at least min_grain items each
+inline size_t chunkSize(size_t size, size_t grain, mt::Executor &executor)
+{
+    static const size_t min_grain = 256;
+    if (grain)
+        return grain;
+    return std::max(min_grain, size / (executor.size() * 4));
+}
+
+inline size_t chunkCount(size_t size, size_t grain, mt::Executor &executor)
+{
+    grain = chunkSize(size, grain, executor);
+    return (size + grain - 1) / grain;
+}
+
+/// fn(chunk, begin, end) is called for each chunk
+template <typename FnT>
+void forChunks(size_t size, size_t grain, mt::Executor &executor, FnT fn)
+{
+    auto count = chunkCount(size, grain, executor);
+    grain = chunkSize(size, grain, executor);
+    if (count <= 1) {
+        if (size)
+            fn(0, 0, size);
+        return;
+    }
+    executor.parallel_for(0, count, [size, grain, &fn](size_t chunk) {
+            auto begin = chunk * grain;
+            fn(chunk, begin, std::min(size, begin + grain));
+        }, 1);
+}
+
+template <typename T>
+QList<T> concat(std::vector<QList<T> > &parts, size_t size)
+{
+    if (parts.size() == 1)
+        return std::move(parts[0]);
+    QList<T> res;
+    res.reserve(size);
+    for (auto &part : parts)
+        res.append(part);
+    return res;
+}
+
+}
+
+/// the same as util::map(fn, src) but fn is executed in parallel
+template <typename ResT, typename T, typename FnT>
+QList<ResT> parallel_map(FnT fn, QList<T> const &src, size_t grain = 0
+                         , mt::Executor &executor = mt::Executor::global())
+{
+    size_t size = src.size();
+    std::vector<QList<ResT> > parts(detail::chunkCount(size, grain, executor));
+    detail::forChunks(size, grain, executor
+                      , [&](size_t chunk, size_t begin, size_t end) {
+            auto &part = parts[chunk];
+            part.reserve(end - begin);
+            for (auto i = begin; i < end; ++i)
+                part.push_back(fn(src[i]));
+        });
+    return detail::concat(parts, size);
+}
+
+/// items for which pred(item) is true, order is preserved
+template <typename T, typename FnT>
+QList<T> parallel_filter(FnT pred, QList<T> const &src, size_t grain = 0
+                         , mt::Executor &executor = mt::Executor::global())
+{
+    size_t size = src.size();
+    std::vector<QList<T> > parts(detail::chunkCount(size, grain, executor));
+    detail::forChunks(size, grain, executor
+                      , [&](size_t chunk, size_t begin, size_t end) {
+            auto &part = parts[chunk];
+            for (auto i = begin; i < end; ++i) {
+                if (pred(src[i]))
+                    part.push_back(src[i]);
+            }
+        });
+    size_t total = 0;
+    for (auto const &part : parts)
+        total += part.size();
+    return detail::concat(parts, total);
+}
+
+/**
+ * Each chunk is reduced with reduce(acc, item) starting from
+ * identity, chunk results are merged in order with combine(acc,
+ * chunk_result) starting from identity. So reduce/combine should be
+ * associative but can be non-commutative
+ */
+template <typename ResT, typename T, typename ReduceT, typename CombineT>
+ResT parallel_reduce(ReduceT reduce, CombineT combine, ResT const &identity
+                     , QList<T> const &src, size_t grain = 0
+                     , mt::Executor &executor = mt::Executor::global())
+{
+    size_t size = src.size();
+    std::vector<ResT> parts(detail::chunkCount(size, grain, executor)
+                            , identity);
+    detail::forChunks(size, grain, executor
+                      , [&](size_t chunk, size_t begin, size_t end) {
+            auto acc = identity;
+            for (auto i = begin; i < end; ++i)
+                acc = reduce(std::move(acc), src[i]);
+            parts[chunk] = std::move(acc);
+        });
+    auto res = identity;
+    for (auto &part : parts)
+        res = combine(std::move(res), std::move(part));
+    return res;
+}
+
+/// reduce with the same associative operation for items and chunks
+template <typename T, typename FnT>
+T parallel_reduce(FnT op, T const &identity, QList<T> const &src
+                  , size_t grain = 0
+                  , mt::Executor &executor = mt::Executor::global())
+{
+    return parallel_reduce(op, op, identity, src, grain, executor);
+}
+
+/**
+ * The same as util::visit() but independent subtrees are visited in
+ * parallel, so visitor should be thread-safe. Parents are still
+ * visited before children, order of siblings is not preserved
+ */
+QVariant visit_parallel(visitor_type visitor, QVariant const &src
+                        , QVariant const &ctx
+                        , mt::Executor &executor = mt::Executor::global());
+
+}}
+
+#endif // _QTAROUND_PARALLEL_HPP_
@@ -0,0 +1,339 @@
+#ifndef _QTAROUND_RANGE_HPP_
+#define _QTAROUND_RANGE_HPP_
+/**
+ * @file range.hpp
+ * @brief Lazy pipelines over Qt containers
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ *
+ * Pipeline steps are fused: items are pulled one by one through all
+ * steps, intermediate containers are not created. Only the final
+ * step (toList(), toMap(), reduce() etc.) produces the result:
+ *
+ * @code
+ * auto sizes = util::split(data, '\n', QString::SkipEmptyParts)
+ *     .map(parse_line)
+ *     .filter(is_valid)
+ *     .take(10)
+ *     .toList();
+ * @endcode
+ *
+ * Range built by from(container) refers to the container, so the
+ * container should outlive the range. Temporary containers are moved
+ * into the range.
+ */
+
+#include <QList>
+#include <QMap>
+#include <QString>
+
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace qtaround { namespace util {
+
+namespace range {
+
+/*
+ * Generator interface: value_type typedef and bool next(value_type &)
+ * returning false when there are no more items. Exhausted generator
+ * should keep returning false.
+ */
+
+template <typename IteratorT>
+class IteratorGen
+{
+public:
+    typedef typename std::decay<decltype(*std::declval<IteratorT>())>::type
+    value_type;
+
+    IteratorGen(IteratorT begin, IteratorT end)
+        : cur_(begin), end_(end)
+    {}
+
+    bool next(value_type &v)
+    {
+        if (cur_ == end_)
+            return false;
+        v = *cur_;
+        ++cur_;
+        return true;
+    }
+
+private:
+    IteratorT cur_;
+    IteratorT end_;
+};
+
+/// owns moved container, shared between copies of the generator
+template <typename ContainerT>
+class ContainerGen
+{
+public:
+    typedef typename ContainerT::const_iterator iterator;
+    typedef typename IteratorGen<iterator>::value_type value_type;
+
+    ContainerGen(ContainerT &&src)
+        : src_(std::make_shared<ContainerT const>(std::move(src)))
+        , gen_(src_->begin(), src_->end())
+    {}
+
+    bool next(value_type &v) { return gen_.next(v); }
+
+private:
+    std::shared_ptr<ContainerT const> src_;
+    IteratorGen<iterator> gen_;
+};
+
+class SplitGen
+{
+public:
+    typedef QString value_type;
+
+    SplitGen(QString const &src, QChar sep, QString::SplitBehavior behavior)
+        : src_(src), sep_(sep)
+        , isSkipEmpty_(behavior == QString::SkipEmptyParts)
+        , pos_(0)
+    {}
+
+    bool next(QString &v)
+    {
+        while (pos_ <= src_.size()) {
+            auto end = src_.indexOf(sep_, pos_);
+            if (end < 0)
+                end = src_.size();
+            auto begin = pos_;
+            pos_ = end + 1;
+            if (end > begin || !isSkipEmpty_) {
+                v = src_.mid(begin, end - begin);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    QString src_;
+    QChar sep_;
+    bool isSkipEmpty_;
+    int pos_;
+};
+
+template <typename GenT, typename FnT>
+class MapGen
+{
+public:
+    typedef typename std::decay<
+        typename std::result_of<FnT(typename GenT::value_type const&)>::type
+        >::type value_type;
+
+    MapGen(GenT const &src, FnT fn) : src_(src), fn_(std::move(fn)) {}
+
+    bool next(value_type &v)
+    {
+        typename GenT::value_type from;
+        if (!src_.next(from))
+            return false;
+        v = fn_(from);
+        return true;
+    }
+
+private:
+    GenT src_;
+    FnT fn_;
+};
+
+template <typename GenT, typename FnT>
+class FilterGen
+{
+public:
+    typedef typename GenT::value_type value_type;
+
+    FilterGen(GenT const &src, FnT pred) : src_(src), pred_(std::move(pred)) {}
+
+    bool next(value_type &v)
+    {
+        while (src_.next(v)) {
+            if (pred_(static_cast<value_type const&>(v)))
+                return true;
+        }
+        return false;
+    }
+
+private:
+    GenT src_;
+    FnT pred_;
+};
+
+template <typename GenT>
+class TakeGen
+{
+public:
+    typedef typename GenT::value_type value_type;
+
+    TakeGen(GenT const &src, size_t count) : src_(src), left_(count) {}
+
+    bool next(value_type &v)
+    {
+        if (!left_ || !src_.next(v))
+            return false;
+        --left_;
+        return true;
+    }
+
+private:
+    GenT src_;
+    size_t left_;
+};
+
+/// the same as util::zip(): second value is default if y is shorter
+template <typename XGenT, typename YGenT>
+class ZipGen
+{
+public:
+    typedef typename XGenT::value_type x_type;
+    typedef typename YGenT::value_type y_type;
+    typedef std::tuple<x_type, y_type> value_type;
+
+    ZipGen(XGenT const &x, YGenT const &y) : x_(x), y_(y) {}
+
+    bool next(value_type &v)
+    {
+        if (!x_.next(std::get<0>(v)))
+            return false;
+        if (!y_.next(std::get<1>(v)))
+            std::get<1>(v) = y_type();
+        return true;
+    }
+
+private:
+    XGenT x_;
+    YGenT y_;
+};
+
+}
+
+template <typename GenT>
+class Range
+{
+public:
+    typedef typename GenT::value_type value_type;
+
+    explicit Range(GenT const &gen) : gen_(gen) {}
+
+    bool next(value_type &v) { return gen_.next(v); }
+
+    GenT const &generator() const { return gen_; }
+
+    /// fn(value_type const &)
+    template <typename FnT>
+    Range<range::MapGen<GenT, FnT> > map(FnT fn) const
+    {
+        return Range<range::MapGen<GenT, FnT> >
+            (range::MapGen<GenT, FnT>(gen_, std::move(fn)));
+    }
+
+    /// items for which pred(value_type const &) is true
+    template <typename FnT>
+    Range<range::FilterGen<GenT, FnT> > filter(FnT pred) const
+    {
+        return Range<range::FilterGen<GenT, FnT> >
+            (range::FilterGen<GenT, FnT>(gen_, std::move(pred)));
+    }
+
+    /// at most count items, source is not pulled after that
+    Range<range::TakeGen<GenT> > take(size_t count) const
+    {
+        return Range<range::TakeGen<GenT> >
+            (range::TakeGen<GenT>(gen_, count));
+    }
+
+    /// any container with push_back()
+    template <typename ContainerT>
+    ContainerT collect()
+    {
+        ContainerT res;
+        value_type v;
+        while (next(v))
+            res.push_back(std::move(v));
+        return res;
+    }
+
+    QList<value_type> toList()
+    {
+        return collect<QList<value_type> >();
+    }
+
+    /// range of std::tuple<K, V> to QMap<K, V>
+    template <typename T = value_type>
+    QMap<typename std::tuple_element<0, T>::type
+         , typename std::tuple_element<1, T>::type> toMap()
+    {
+        QMap<typename std::tuple_element<0, T>::type
+             , typename std::tuple_element<1, T>::type> res;
+        value_type v;
+        while (next(v))
+            res.insert(std::get<0>(v), std::get<1>(v));
+        return res;
+    }
+
+    /// fn(ResT acc, value_type const &) returns new acc
+    template <typename ResT, typename FnT>
+    ResT reduce(ResT acc, FnT fn)
+    {
+        value_type v;
+        while (next(v))
+            acc = fn(std::move(acc), static_cast<value_type const&>(v));
+        return acc;
+    }
+
+    template <typename FnT>
+    void forEach(FnT fn)
+    {
+        value_type v;
+        while (next(v))
+            fn(static_cast<value_type const&>(v));
+    }
+
+private:
+    GenT gen_;
+};
+
+template <typename ContainerT>
+Range<range::IteratorGen<typename ContainerT::const_iterator> >
+from(ContainerT const &src)
+{
+    typedef range::IteratorGen<typename ContainerT::const_iterator> gen_type;
+    return Range<gen_type>(gen_type(src.begin(), src.end()));
+}
+
+template <typename ContainerT>
+Range<range::ContainerGen<ContainerT> >
+from(ContainerT &&src
+     , typename std::enable_if<!std::is_lvalue_reference<ContainerT>::value>::type* = 0)
+{
+    typedef range::ContainerGen<ContainerT> gen_type;
+    return Range<gen_type>(gen_type(std::move(src)));
+}
+
+/// lazy QString::split()
+inline Range<range::SplitGen> split
+(QString const &src, QChar sep
+ , QString::SplitBehavior behavior = QString::KeepEmptyParts)
+{
+    return Range<range::SplitGen>(range::SplitGen(src, sep, behavior));
+}
+
+template <typename XGenT, typename YGenT>
+Range<range::ZipGen<XGenT, YGenT> >
+zip(Range<XGenT> const &x, Range<YGenT> const &y)
+{
+    typedef range::ZipGen<XGenT, YGenT> gen_type;
+    return Range<gen_type>(gen_type(x.generator(), y.generator()));
+}
+
+}}
+
+#endif // _QTAROUND_RANGE_HPP_
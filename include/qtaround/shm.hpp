@@ -0,0 +1,176 @@
+#ifndef _QTAROUND_SHM_HPP_
+#define _QTAROUND_SHM_HPP_
+/**
+ * @file shm.hpp
+ * @brief Shared memory transport between processes
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ *
+ * Ring buffer is placed into the memfd-backed shared memory, peers
+ * are woken up through eventfd only if they are sleeping, so bulk
+ * data transfer costs two memory copies and almost no syscalls.
+ *
+ * Ring is created by one process and attached by another one using
+ * descriptors passed through fork() or SCM_RIGHTS. Descriptors are
+ * created with O_CLOEXEC.
+ *
+ * @code
+ * // sender process
+ * auto ring = shm::Ring::create(1 << 20);
+ * passToPeer(ring->fds());
+ * shm::RemoteActor storage(ring);
+ * storage.post("chunk", data);
+ *
+ * // receiver process
+ * auto ring = shm::Ring::attach(fdsFromPeer());
+ * shm::ActorEndpoint endpoint(ring, storage_actor);
+ * endpoint.on<Storage>("chunk", [](Storage *s, QByteArray const &data) {
+ *         s->write(data);
+ *     });
+ * endpoint.start();
+ * @endcode
+ */
+
+#include <qtaround/mt.hpp>
+
+#include <QByteArray>
+#include <QMap>
+#include <QString>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace qtaround { namespace shm {
+
+/// descriptors the peer needs to attach to the ring
+struct RingFds
+{
+    int memory;
+    /// signaled by writer when reader is waiting for data
+    int data;
+    /// signaled by reader when writer is waiting for space
+    int space;
+};
+
+class RingImpl;
+
+/**
+ * Single producer, single consumer ring buffer of variable size
+ * messages. Each side can be used by several threads of the same
+ * process, they are serialized
+ */
+class Ring
+{
+public:
+    /// capacity is rounded up to the power of 2, at least page size
+    static std::shared_ptr<Ring> create(size_t capacity);
+
+    /// descriptors are duplicated, caller still owns passed ones
+    static std::shared_ptr<Ring> attach(RingFds const &);
+
+    ~Ring();
+
+    Ring(Ring const&) = delete;
+    Ring& operator = (Ring const&) = delete;
+
+    RingFds fds() const;
+    size_t capacity() const;
+    size_t maxMessageSize() const;
+
+    /**
+     * Blocks while ring is full, timeout: 0 - do not block, negative -
+     * forever. Raises error if message is larger than maxMessageSize()
+     *
+     * @return false on timeout or if ring is closed
+     */
+    bool write(char const *data, size_t len, long msec = -1);
+    bool write(QByteArray const &data, long msec = -1)
+    {
+        return write(data.constData(), data.size(), msec);
+    }
+
+    /// @return false on timeout or if ring is closed and empty
+    bool read(QByteArray &data, long msec = -1);
+
+    /// wakes up both sides, closing is visible to the peer
+    void close();
+    bool isClosed() const;
+
+private:
+    Ring(std::unique_ptr<RingImpl>);
+
+    std::unique_ptr<RingImpl> impl_;
+};
+
+/**
+ * Sending side of the remote actor: mirrors Actor::post() but
+ * message is identified by the key and carries serialized data.
+ */
+class RemoteActor
+{
+public:
+    RemoteActor(std::shared_ptr<Ring> const &ring) : ring_(ring) {}
+
+    /**
+     * Message is delivered to the handler registered for the key by
+     * the peer ActorEndpoint. Blocks if the ring is full (actor
+     * mailbox backpressure is propagated through the ring)
+     */
+    bool post(QString const &key, QByteArray const &data, long msec = -1);
+
+    void close() { ring_->close(); }
+
+private:
+    std::shared_ptr<Ring> ring_;
+    QByteArray buffer_;
+    std::mutex mutex_;
+};
+
+/**
+ * Receiving side: messages are read from the ring by the endpoint
+ * thread and posted to the local actor as messages with the same
+ * key, so they can be coalesced by batching actors. Messages with
+ * unknown keys are logged and dropped.
+ */
+class ActorEndpoint
+{
+public:
+    typedef std::function<void(QObject*, QByteArray const&)> handler_type;
+
+    ActorEndpoint(std::shared_ptr<Ring> const &, mt::ActorHandle const &);
+    /// closes the ring and stops the endpoint thread
+    ~ActorEndpoint();
+
+    ActorEndpoint(ActorEndpoint const&) = delete;
+    ActorEndpoint& operator = (ActorEndpoint const&) = delete;
+
+    /// fn(T*, QByteArray const &) is executed by the actor
+    template <typename T, typename FnT>
+    void on(QString const &key, FnT fn)
+    {
+        setHandler(key, [fn](QObject *obj, QByteArray const &data) {
+                fn(static_cast<T*>(obj), data);
+            });
+    }
+
+    /// handlers should be registered before
+    void start();
+
+    /// wait until peer closes the ring and all messages are posted
+    void wait();
+
+private:
+    void setHandler(QString const &, handler_type);
+    void run();
+
+    std::shared_ptr<Ring> ring_;
+    mt::ActorHandle actor_;
+    QMap<QString, std::shared_ptr<handler_type> > handlers_;
+    std::thread thread_;
+};
+
+}}
+
+#endif // _QTAROUND_SHM_HPP_
@@ -8,21 +8,41 @@
  * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
  */
 
+#include <qtaround/future.hpp>
+
 #include <memory>
 
 #include <QProcess>
 #include <QVariant>
 
+#include <sys/resource.h>
+#include <string.h>
+
 namespace qtaround { namespace subprocess {
 
+/**
+ * Result of the finished process
+ */
+struct Result
+{
+    Result() : rc(0)
+    {
+        memset(&usage, 0, sizeof(usage));
+    }
+
+    int rc;
+    QByteArray stdout;
+    QByteArray stderr;
+    /// why the process failed to start or crashed, empty if it exited
+    QString info;
+    /// filled in only if process was spawned by the fork server
+    struct rusage usage;
+};
+
 class Process : public QObject
 {
 public:
-    Process()
-        : ps(new QProcess())
-        , isRunning_(false)
-        , isError_(false)
-    {}
+    Process();
 
     Process(Process &&from)
         : ps(std::move(from.ps))
@@ -57,6 +77,52 @@ public:
         return ps->write(data.toUtf8());
     }
 
+    qint64 write(QByteArray const &data)
+    {
+        return ps->write(data);
+    }
+
+    qint64 write(char const *data)
+    {
+        return ps->write(data);
+    }
+
+    /// copy all data from the device to the child stdin
+    qint64 write(QIODevice &src);
+
+    /**
+     * Redirections below should be set before the process is
+     * started. Child process uses file or descriptor directly, so
+     * redirected data is not passing through the parent process.
+     * Passed descriptors should be valid till the process is started
+     */
+    void setStdin(int fd);
+    void setStdout(int fd);
+    void setStderr(int fd);
+
+    void setStdinFile(QString const &path)
+    {
+        ps->setStandardInputFile(path);
+    }
+
+    void setStdoutFile(QString const &path, bool append = false)
+    {
+        ps->setStandardOutputFile(path, append ? QIODevice::Append
+                                  : QIODevice::Truncate);
+    }
+
+    void setStderrFile(QString const &path, bool append = false)
+    {
+        ps->setStandardErrorFile(path, append ? QIODevice::Append
+                                 : QIODevice::Truncate);
+    }
+
+    /// connect stdout of this process to the dst stdin
+    void pipeTo(Process &dst)
+    {
+        ps->setStandardOutputProcess(dst.ps.get());
+    }
+
     QByteArray stdout() const;
 
     QByteArray stderr() const;
@@ -100,6 +166,117 @@ private slots:
     void onFinished(int, QProcess::ExitStatus);
 };
 
+/**
+ * Long-lived co-process (shell by default) executing commands passed
+ * through its stdin, so repeated invocations cost a pipe round trip
+ * instead of a process start. Command output is framed by the
+ * sentinel printed after each command together with its exit
+ * code. Commands stdin is /dev/null. Should be used from the thread
+ * it was created in.
+ */
+class Session
+{
+public:
+    Session(QString const &cmd = "sh", QStringList const &args = QStringList());
+    virtual ~Session();
+
+    Session(Session const&) = delete;
+    Session& operator = (Session const&) = delete;
+
+    /// execute shell command line
+    Result execute(QString const &cmd_line, int timeout = -1);
+
+    /// execute command, arguments are quoted
+    Result execute(QString const &cmd, QStringList const &args
+                   , int timeout = -1);
+
+    QByteArray check_output(QString const &, QStringList const &
+                            , QVariantMap const &error_info = QVariantMap());
+    int check_call(QString const &, QStringList const &
+                   , QVariantMap const &error_info = QVariantMap());
+
+    bool isRunning() const;
+    void close(int timeout = 3000);
+
+protected:
+    /**
+     * Wrap command line to make co-process print marker + " " + rc +
+     * "\n" to stdout and marker + "\n" to stderr after the command
+     * is executed. Default implementation is for sh-compatible shells
+     */
+    virtual QByteArray frame(QByteArray const &cmd_line
+                             , QByteArray const &marker) const;
+
+private:
+    bool ensureStarted();
+
+    QString cmd_;
+    QStringList args_;
+    /// directory the co-process was started in, reported on errors
+    QString cwd_;
+    std::unique_ptr<QProcess> ps_;
+    QByteArray sentinel_;
+    quint64 seq_;
+};
+
+/**
+ * Memoizing cache for the results of idempotent probe commands, keyed
+ * by command, arguments, environment and working directory. Caching is
+ * opt-in per call: only commands executed through the cache are
+ * memoized, so it should be used only for probes returning the same
+ * result over time. Entries expire after ttl milliseconds, failed
+ * commands (rc != 0) are not cached. If the cache is full expired
+ * entries are dropped first, then the least recently used one.
+ */
+class Cache
+{
+public:
+    static Cache &instance();
+
+    void setTtl(int msec);
+    int ttl() const;
+
+    /// execute command or return cached result, rc is not checked
+    Result run(QString const &cmd, QStringList const &args);
+
+    QByteArray check_output(QString const &, QStringList const &
+                            , QVariantMap const &error_info = QVariantMap());
+
+    void invalidate();
+    /// invalidate all entries for the command
+    void invalidate(QString const &cmd);
+
+    /// hits, misses, expired, size
+    QVariantMap stats() const;
+    void resetStats();
+
+private:
+    Cache();
+    Cache(Cache const&) = delete;
+    Cache& operator = (Cache const&) = delete;
+
+    class Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+/**
+ * Start fork server: small helper process spawning children on
+ * behalf of the application, so the application itself is not forked
+ * for each spawned command. While it is running check_output,
+ * check_call and call are executed through it. Should be called
+ * early, before other threads are started. Server is killed when
+ * the thread started it exits, so it can be started only from the
+ * main thread, otherwise it is not started and false is returned.
+ *
+ * @return true if server is running
+ */
+bool startForkServer();
+void stopForkServer();
+bool isForkServerRunning();
+
+/// run process, return code is not checked
+int call(QString const &cmd, QStringList const &args = QStringList());
+
 QByteArray check_output(QString const &cmd, QStringList const &args, QVariantMap const &);
 static inline QByteArray check_output(QString const &cmd, QStringList const &args)
 {
@@ -112,6 +289,32 @@ static inline int check_call(QString const &cmd, QStringList const &args)
     return check_call(cmd, args, QVariantMap());
 }
 
+/**
+ * Asynchronous counterparts of call/check_output/check_call. Process
+ * is controlled from the calling thread event loop, so many processes
+ * can run concurrently from one thread w/o additional threads. The
+ * calling thread should have running event loop and should not block
+ * waiting for the future.
+ *
+ * Canceling the future kills the process.
+ *
+ * Options:
+ * - timeout: milliseconds, process is killed and future is failed
+ * - cwd: working directory
+ */
+mt::Future<Result> run_async(QString const &cmd, QStringList const &args
+                             , QVariantMap const &options = QVariantMap());
+
+mt::Future<QByteArray> check_output_async
+(QString const &cmd, QStringList const &args
+ , QVariantMap const &error_info = QVariantMap()
+ , QVariantMap const &options = QVariantMap());
+
+mt::Future<int> check_call_async
+(QString const &cmd, QStringList const &args
+ , QVariantMap const &error_info = QVariantMap()
+ , QVariantMap const &options = QVariantMap());
+
 static inline Process start
 (QString const &name, QStringList const &args = QStringList{})
 {
@@ -20,6 +20,164 @@
 #include <tuple>
 #include <memory>
 #include <array>
+#include <cstring>
+#include <type_traits>
+
+namespace qtaround { namespace util { namespace detail {
+
+/**
+ * Argument of the str(): length is known before it is written, so
+ * all pieces can be copied into the single preallocated buffer.
+ * Numbers and ASCII strings are converted without intermediate
+ * QString. Piece only refers to the argument, so it should not
+ * outlive it.
+ */
+class StrPiece
+{
+public:
+    StrPiece(QString const &v)
+        : kind_(Utf16), utf16_(v.constData()), size_(v.size())
+    {}
+
+    StrPiece(QLatin1String v)
+        : kind_(Latin1), chars_(v.data()), size_(v.size())
+    {}
+
+    StrPiece(QChar v)
+        : kind_(Char), char_(v), size_(1)
+    {}
+
+    StrPiece(char const *v)
+    {
+        setUtf8(v, v ? std::strlen(v) : 0);
+    }
+
+    StrPiece(QByteArray const &v)
+    {
+        setUtf8(v.constData(), v.size());
+    }
+
+    StrPiece(QVariant const &v)
+        : kind_(Owned), tmp_(v.toString()), size_(tmp_.size())
+    {}
+
+    template <typename T>
+    StrPiece(T v, typename std::enable_if
+             <std::is_integral<T>::value || std::is_enum<T>::value>::type* = 0)
+        : kind_(Number)
+    {
+        setNumber(static_cast<typename std::conditional
+                  <std::is_signed<T>::value, long long
+                  , unsigned long long>::type>(v));
+    }
+
+    /// formatted as QString::number(v)
+    template <typename T>
+    StrPiece(T v, typename std::enable_if
+             <std::is_floating_point<T>::value>::type* = 0)
+        : kind_(Owned), tmp_(QString::number(static_cast<double>(v)))
+        , size_(tmp_.size())
+    {}
+
+    int size() const { return size_; }
+
+    /// @return position after the written piece
+    QChar *write(QChar *dst) const
+    {
+        switch (kind_) {
+        case Utf16:
+            std::memcpy(dst, utf16_, size_ * sizeof(QChar));
+            break;
+        case Owned:
+            std::memcpy(dst, tmp_.constData(), size_ * sizeof(QChar));
+            break;
+        case Char:
+            *dst = char_;
+            break;
+        case Latin1:
+            for (int i = 0; i < size_; ++i)
+                dst[i] = QChar(static_cast<ushort>(static_cast<uchar>(chars_[i])));
+            break;
+        case Number:
+            for (int i = 0; i < size_; ++i)
+                dst[i] = QChar(static_cast<ushort>(number_[i]));
+            break;
+        }
+        return dst + size_;
+    }
+
+private:
+    void setUtf8(char const *v, size_t len)
+    {
+        for (size_t i = 0; i < len; ++i) {
+            if (static_cast<uchar>(v[i]) & 0x80) {
+                kind_ = Owned;
+                tmp_ = QString::fromUtf8(v, static_cast<int>(len));
+                size_ = tmp_.size();
+                return;
+            }
+        }
+        // ASCII is the same in Latin-1
+        kind_ = Latin1;
+        chars_ = v;
+        size_ = static_cast<int>(len);
+    }
+
+    void setNumber(unsigned long long v)
+    {
+        char buf[sizeof(number_)];
+        char *p = buf + sizeof(buf);
+        do {
+            *--p = '0' + static_cast<char>(v % 10);
+            v /= 10;
+        } while (v);
+        size_ = static_cast<int>(buf + sizeof(buf) - p);
+        std::memcpy(number_, p, size_);
+    }
+
+    void setNumber(long long v)
+    {
+        if (v >= 0) {
+            setNumber(static_cast<unsigned long long>(v));
+            return;
+        }
+        // negation of the minimal value does not fit into long long
+        setNumber(0ull - static_cast<unsigned long long>(v));
+        std::memmove(number_ + 1, number_, size_);
+        number_[0] = '-';
+        ++size_;
+    }
+
+    enum Kind { Utf16, Latin1, Char, Owned, Number };
+
+    Kind kind_;
+    union {
+        QChar const *utf16_;
+        char const *chars_;
+    };
+    QChar char_;
+    QString tmp_;
+    int size_;
+    // sign and up to 20 digits
+    char number_[24];
+};
+
+/// two passes: pieces lengths are summed up and then copied
+template <typename ... A>
+QString strConcat(A &&...args)
+{
+    StrPiece const pieces[] = { StrPiece(std::forward<A>(args))... };
+    int size = 0;
+    for (auto const &piece : pieces)
+        size += piece.size();
+    QString res(size, Qt::Uninitialized);
+    auto dst = res.data();
+    for (auto const &piece : pieces)
+        dst = piece.write(dst);
+    return res;
+}
+
+}}}
 
 namespace {
 
@@ -28,6 +186,16 @@ inline QString str(QVariant const &v)
     return v.toString();
 }
 
+inline QString str(QString const &v)
+{
+    return v;
+}
+
+inline QString str(QLatin1String v)
+{
+    return QString(v);
+}
+
 inline QString str(QByteArray const &v)
 {
     return QString::fromUtf8(v);
@@ -38,15 +206,29 @@ inline QString str(int v)
     return QString::number(v);
 }
 
+/// other integers and floating point numbers
+template <typename T>
+typename std::enable_if<std::is_arithmetic<T>::value, QString>::type
+str(T v)
+{
+    return qtaround::util::detail::strConcat(v);
+}
+
 inline QString str(char const *v)
 {
     return QString(v);
 }
 
+/**
+ * Concatenation of arguments converted as single argument str() does
+ * plus QString, QLatin1String, QChar and numbers. Result is built in
+ * the single allocation
+ */
 template <typename T, typename T2, typename ... A>
 QString str(T && v, T2 && v2, A &&...args)
 {
-    return str(std::forward<T>(v)) + str(std::forward<T2>(v2), std::forward<A>(args)...);
+    return qtaround::util::detail::strConcat
+        (std::forward<T>(v), std::forward<T2>(v2), std::forward<A>(args)...);
 }
 
 inline bool is(QVariant const &v)
@@ -297,6 +479,7 @@ template <typename ResT, typename T, typename FnT>
 QList<ResT> map(FnT fn, QList<T> const &src)
 {
     QList<ResT> res;
+    res.reserve(src.size());
     for (auto it = src.begin(); it != src.end(); ++it) {
         res.push_back(fn(*it));
     }
@@ -307,6 +490,7 @@ template <typename ResT, typename FnT, typename K, typename V>
 QList<ResT> map(FnT fn, QMap<K, V> const &src)
 {
     QList<ResT> res;
+    res.reserve(src.size());
     for (auto it = src.begin(); it != src.end(); ++it) {
         res.push_back(fn(it.key(), it.value()));
     }
@@ -317,6 +501,7 @@ template <typename ResT, typename FnT>
 QList<ResT> map(FnT fn, QString const &src)
 {
     QList<ResT> res;
+    res.reserve(src.size());
     for (auto it = src.begin(); it != src.end(); ++it) {
         res.push_back(fn(*it));
     }
@@ -327,6 +512,7 @@ template <typename X, typename Y>
 QList<std::tuple<X, Y> > zip(QList<X> const &x, QList<Y> const &y)
 {
     QList<std::tuple<X, Y> > res;
+    res.reserve(x.size());
     auto yit = y.begin();
     auto xit = x.begin();
     for(;xit != x.end(); ++xit, ++yit) {
@@ -344,19 +530,56 @@ QList<std::tuple<X, Y> > zip(QList<X> const &x, QList<Y> const &y)
 template <typename ResKeyT, typename T, typename K>
 QMap<ResKeyT, T> mapByField(QList<T> const &src, K const &key)
 {
-    auto fn = [&key](T const &v) { return std::make_tuple(get<ResKeyT>(v[key]), v); };
-    auto pairs = map<std::tuple<ResKeyT, T> >(fn, src);
-    return ::map(pairs);
+    QMap<ResKeyT, T> res;
+    for (auto it = src.begin(); it != src.end(); ++it)
+        res.insert(get<ResKeyT>((*it)[key]), *it);
+    return res;
 }
 
 double parseBytes(QString const &s, QString const &unit = "b"
                   , long multiplier = 1024);
 
+/**
+ * Counterpart of parseBytes(): value measured in unit is formatted
+ * using the largest multiplier suffix (K, M, G...) leaving at least
+ * 1 before the point, e.g. 1536 -> "1.5K". At most precision digits
+ * are shown after the point, trailing zeros are dropped
+ */
+QString formatBytes(double value, QString const &unit = "b"
+                    , long multiplier = 1024, int precision = 1);
+
 typedef std::function<QVariant (QVariant const &
                                 , QVariant const &
                                 , QVariant const &)> visitor_type;
+
+/**
+ * Pre-order traversal of the QVariantMap/QVariantList tree:
+ * visitor(ctx, key, value) is called for each node, returned value
+ * is the context passed to visitor for node children. Root key is
+ * invalid QVariant.
+ *
+ * Traversal uses explicit stack and does not copy containers, so
+ * deep trees can be visited.
+ *
+ * @return context returned by visitor for the root
+ */
 QVariant visit(visitor_type visitor, QVariant const &src, QVariant const &ctx);
 
+/**
+ * transformer(key, value, replacement) returns true if value should
+ * be replaced with replacement
+ */
+typedef std::function<bool (QVariant const &
+                            , QVariant const &
+                            , QVariant &)> transformer_type;
+
+/**
+ * Copy of the src tree with values replaced by transformer,
+ * replaced values are not traversed. Only containers on the path to
+ * replaced values are rebuilt, other ones are shared with src.
+ */
+QVariant transform(transformer_type transformer, QVariant const &src);
+
 }}
 
 #define UNIQUE_PTR(T) std::unique_ptr<T, void(*)(T*)>
@@ -0,0 +1,162 @@
+/**
+ * @file channel.cpp
+ * @brief Bounded multi-producer multi-consumer channels
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <qtaround/channel.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+namespace qtaround { namespace mt {
+
+namespace detail {
+
+typedef std::chrono::steady_clock clock_type;
+
+void ChannelWaiter::notify()
+{
+    std::lock_guard<std::mutex> l(mutex_);
+    signaled_ = true;
+    cond_.notify_one();
+}
+
+bool ChannelWaiter::wait(long msec)
+{
+    std::unique_lock<std::mutex> l(mutex_);
+    auto is_signaled = [this]() { return signaled_; };
+    if (msec < 0)
+        cond_.wait(l, is_signaled);
+    else if (!cond_.wait_for(l, std::chrono::milliseconds(msec), is_signaled))
+        return false;
+    signaled_ = false;
+    return true;
+}
+
+ChannelBase::ChannelBase()
+    : readers_(0), writers_(0), closed_(false)
+{}
+
+void ChannelBase::close()
+{
+    closed_.store(true, std::memory_order_release);
+    wakeReaders();
+    wakeWriters();
+}
+
+void ChannelBase::addSelect(ChannelWaiter *waiter)
+{
+    std::lock_guard<std::mutex> l(mutex_);
+    selects_.push_back(waiter);
+    ++readers_;
+}
+
+void ChannelBase::removeSelect(ChannelWaiter *waiter)
+{
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = std::find(selects_.begin(), selects_.end(), waiter);
+    if (it != selects_.end()) {
+        selects_.erase(it);
+        --readers_;
+    }
+}
+
+bool ChannelBase::waitFor(std::condition_variable &cond
+                          , std::atomic<int> &counter
+                          , std::function<bool()> const &try_op
+                          , long msec)
+{
+    auto deadline = clock_type::now() + std::chrono::milliseconds(msec);
+    std::unique_lock<std::mutex> l(mutex_);
+    ++counter;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    bool res = true;
+    while (!try_op()) {
+        if (msec < 0) {
+            cond.wait(l);
+        } else if (cond.wait_until(l, deadline) == std::cv_status::timeout) {
+            res = try_op();
+            break;
+        }
+    }
+    --counter;
+    return res;
+}
+
+void ChannelBase::wakeReaders()
+{
+    std::lock_guard<std::mutex> l(mutex_);
+    readable_.notify_all();
+    for (auto waiter : selects_)
+        waiter->notify();
+}
+
+void ChannelBase::wakeWriters()
+{
+    std::lock_guard<std::mutex> l(mutex_);
+    writable_.notify_all();
+}
+
+} // detail
+
+int Select::tryOnce()
+{
+    auto count = cases_.size();
+    for (size_t i = 0; i < count; ++i) {
+        auto index = (next_ + i) % count;
+        if (cases_[index].tryReceive()) {
+            next_ = index + 1;
+            return (int)index;
+        }
+    }
+    return Timeout;
+}
+
+int Select::wait(long msec)
+{
+    auto is_all_closed = [this]() {
+        return std::all_of(cases_.begin(), cases_.end(), [](Case const &c) {
+                return c.channel->isClosed();
+            });
+    };
+    auto is_closed = is_all_closed();
+    auto res = tryOnce();
+    if (res >= 0)
+        return res;
+    if (is_closed)
+        return Closed;
+    if (!msec)
+        return Timeout;
+
+    for (auto &c : cases_)
+        c.channel->addSelect(&waiter_);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    auto deadline = detail::clock_type::now() + std::chrono::milliseconds(msec);
+    while (true) {
+        is_closed = is_all_closed();
+        res = tryOnce();
+        if (res >= 0)
+            break;
+        if (is_closed) {
+            res = Closed;
+            break;
+        }
+        long left = -1;
+        if (msec >= 0) {
+            left = std::chrono::duration_cast<std::chrono::milliseconds>
+                (deadline - detail::clock_type::now()).count();
+            if (left <= 0)
+                break;
+        }
+        waiter_.wait(left);
+    }
+
+    for (auto &c : cases_)
+        c.channel->removeSelect(&waiter_);
+    return res;
+}
+
+}}
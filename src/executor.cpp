@@ -0,0 +1,712 @@
+/**
+ * @file executor.cpp
+ * @brief Work-stealing thread pool
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <qtaround/executor.hpp>
+#include <qtaround/debug.hpp>
+
+#include <QThread>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace qtaround { namespace mt {
+
+typedef Executor::task_type task_type;
+
+class ExecutorImpl
+{
+public:
+    ExecutorImpl(size_t size);
+    ~ExecutorImpl();
+
+    size_t size() const { return queues_.size(); }
+
+    void push(task_type, bool is_deferred);
+    bool tryRunOne();
+
+    void runWorker(size_t index);
+
+private:
+    struct Queue
+    {
+        std::mutex mutex_;
+        std::deque<task_type> tasks_;
+    };
+
+    class Worker : public QThread
+    {
+    public:
+        Worker(ExecutorImpl *executor, size_t index)
+            : executor_(executor), index_(index)
+        {}
+    protected:
+        void run() Q_DECL_OVERRIDE { executor_->runWorker(index_); }
+    private:
+        ExecutorImpl *executor_;
+        size_t index_;
+    };
+
+    bool pop(task_type &);
+    void run(task_type &);
+
+    std::vector<std::unique_ptr<Queue> > queues_;
+    Queue shared_;
+    std::vector<std::unique_ptr<Worker> > workers_;
+
+    std::atomic<size_t> pending_;
+    std::atomic<size_t> sleeping_;
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cond_;
+    bool isStopped_;
+};
+
+static thread_local ExecutorImpl *current_executor_ = nullptr;
+static thread_local size_t current_worker_ = 0;
+
+ExecutorImpl::ExecutorImpl(size_t size)
+    : pending_(0), sleeping_(0), isStopped_(false)
+{
+    for (size_t i = 0; i < size; ++i)
+        queues_.emplace_back(new Queue());
+    for (size_t i = 0; i < size; ++i) {
+        workers_.emplace_back(new Worker(this, i));
+        workers_.back()->start();
+    }
+}
+
+ExecutorImpl::~ExecutorImpl()
+{
+    do {
+        std::lock_guard<std::mutex> l(sleep_mutex_);
+        isStopped_ = true;
+        sleep_cond_.notify_all();
+    } while (0);
+    for (auto &w : workers_)
+        w->wait();
+}
+
+void ExecutorImpl::push(task_type task, bool is_deferred)
+{
+    if (current_executor_ == this) {
+        auto &q = *queues_[current_worker_];
+        std::lock_guard<std::mutex> l(q.mutex_);
+        if (is_deferred)
+            q.tasks_.push_front(std::move(task));
+        else
+            q.tasks_.push_back(std::move(task));
+    } else {
+        std::lock_guard<std::mutex> l(shared_.mutex_);
+        shared_.tasks_.push_back(std::move(task));
+    }
+    ++pending_;
+    if (sleeping_) {
+        do {
+            std::lock_guard<std::mutex> l(sleep_mutex_);
+        } while (0);
+        sleep_cond_.notify_one();
+    }
+}
+
+bool ExecutorImpl::pop(task_type &task)
+{
+    auto take = [&task](Queue &q, bool is_owner) {
+        std::lock_guard<std::mutex> l(q.mutex_);
+        if (q.tasks_.empty())
+            return false;
+        if (is_owner) {
+            task = std::move(q.tasks_.back());
+            q.tasks_.pop_back();
+        } else {
+            task = std::move(q.tasks_.front());
+            q.tasks_.pop_front();
+        }
+        return true;
+    };
+
+    auto is_worker = (current_executor_ == this);
+    auto self = is_worker ? current_worker_ : 0;
+    auto found = (is_worker && take(*queues_[self], true))
+        || take(shared_, false);
+    // steal the oldest task starting from the next worker
+    for (size_t i = 0; !found && i < queues_.size(); ++i) {
+        auto victim = (self + i + 1) % queues_.size();
+        if (!is_worker || victim != self)
+            found = take(*queues_[victim], false);
+    }
+    if (found)
+        --pending_;
+    return found;
+}
+
+void ExecutorImpl::run(task_type &task)
+{
+    try {
+        task();
+    } catch (std::exception const &e) {
+        debug::warning("Executor task exception:", e.what());
+    } catch (...) {
+        debug::warning("Executor task unknown exception");
+    }
+}
+
+bool ExecutorImpl::tryRunOne()
+{
+    // other threads would take pooled actors and foreign tasks
+    if (current_executor_ != this)
+        return false;
+    task_type task;
+    if (!pop(task))
+        return false;
+    run(task);
+    return true;
+}
+
+void ExecutorImpl::runWorker(size_t index)
+{
+    current_executor_ = this;
+    current_worker_ = index;
+    while (true) {
+        task_type task;
+        if (pop(task)) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> l(sleep_mutex_);
+        ++sleeping_;
+        sleep_cond_.wait(l, [this]() { return isStopped_ || pending_; });
+        --sleeping_;
+        if (isStopped_ && !pending_)
+            break;
+    }
+    current_executor_ = nullptr;
+}
+
+Executor::Executor(QVariantMap const &options)
+{
+    auto size = options.value("threads").toInt();
+    if (size <= 0)
+        size = std::max(2, QThread::idealThreadCount());
+    impl_.reset(new ExecutorImpl(size));
+}
+
+Executor::~Executor()
+{}
+
+Executor &Executor::global()
+{
+    static Executor self;
+    return self;
+}
+
+size_t Executor::size() const
+{
+    return impl_->size();
+}
+
+void Executor::execute(task_type task)
+{
+    impl_->push(std::move(task), false);
+}
+
+void Executor::defer(task_type task)
+{
+    impl_->push(std::move(task), true);
+}
+
+bool Executor::tryRunOne()
+{
+    return impl_->tryRunOne();
+}
+
+void Executor::parallel_for(size_t begin, size_t end
+                            , std::function<void(size_t)> const &fn
+                            , size_t grain)
+{
+    if (begin >= end)
+        return;
+    if (!grain)
+        grain = std::max<size_t>(1, (end - begin) / (size() * 4));
+
+    TaskGroup group(*this);
+    for (auto b = begin; b < end; b += std::min(grain, end - b)) {
+        auto e = b + std::min(grain, end - b);
+        group.run([b, e, &fn]() {
+                for (auto i = b; i < e; ++i)
+                    fn(i);
+            });
+    }
+    group.wait();
+}
+
+/**
+ * Group tasks are queued here and the executor gets only wrappers
+ * taking the next one, so joining thread can help with the tasks of
+ * its group without touching unrelated ones (e.g. pooled actor
+ * mailboxes)
+ */
+class TaskGroup::State
+{
+public:
+    State() : count_(0) {}
+
+    void add(task_type fn)
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        tasks_.push_back(std::move(fn));
+        ++count_;
+    }
+
+    /**
+     * Execute one of not started tasks, executor takes the oldest
+     * one, joining thread - the newest
+     *
+     * @return false if all tasks are already started
+     */
+    bool runOne(bool is_newest)
+    {
+        task_type fn;
+        {
+            std::lock_guard<std::mutex> l(mutex_);
+            if (tasks_.empty())
+                return false;
+            if (is_newest) {
+                fn = std::move(tasks_.back());
+                tasks_.pop_back();
+            } else {
+                fn = std::move(tasks_.front());
+                tasks_.pop_front();
+            }
+        }
+        std::exception_ptr error;
+        try {
+            fn();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        done(error);
+        return true;
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> l(mutex_);
+        cond_.wait(l, [this]() { return !count_; });
+    }
+
+    std::exception_ptr takeError()
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto e = error_;
+        error_ = nullptr;
+        return e;
+    }
+
+private:
+    void done(std::exception_ptr e)
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (e && !error_)
+            error_ = e;
+        if (!--count_)
+            cond_.notify_all();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<task_type> tasks_;
+    size_t count_;
+    std::exception_ptr error_;
+};
+
+TaskGroup::TaskGroup(Executor &executor)
+    : executor_(executor)
+    , state_(std::make_shared<State>())
+{}
+
+TaskGroup::~TaskGroup()
+{
+    join();
+}
+
+void TaskGroup::run(Executor::task_type fn)
+{
+    state_->add(std::move(fn));
+    auto state = state_;
+    executor_.execute([state]() { state->runOne(false); });
+}
+
+void TaskGroup::join()
+{
+    // only tasks of this group are executed by the joining thread,
+    // the rest are already being executed by workers
+    while (state_->runOne(true)) {}
+    state_->wait();
+}
+
+void TaskGroup::wait()
+{
+    join();
+    auto error = state_->takeError();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+class TaskGraph::State : public std::enable_shared_from_this<State>
+{
+public:
+    State(Executor &executor)
+        : executor_(executor), isStarted_(false), isCanceled_(false)
+        , left_(0)
+    {}
+
+    task_id add(QString const &name, task_type fn)
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        checkNotStarted();
+        tasks_.emplace_back(name, std::move(fn));
+        ++left_;
+        return tasks_.size() - 1;
+    }
+
+    void depends(task_id task, task_id dep)
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        checkNotStarted();
+        if (task >= tasks_.size() || dep >= tasks_.size())
+            error::raise({{"msg", "Unknown task"}, {"task", (quint64)task}
+                    , {"dep", (quint64)dep}});
+        if (task == dep)
+            error::raise({{"msg", "Task can't depend on itself"}
+                    , {"task", tasks_[task].name_}});
+        auto &src = tasks_[dep];
+        src.dependents_.push_back(task);
+        ++tasks_[task].deps_;
+        if (src.state_ == Canceled)
+            cancelTask(task);
+    }
+
+    Future<void> run();
+    void cancel(task_id);
+    void cancel();
+    void wait();
+    QVariantList stats() const;
+
+private:
+    enum TaskState { Pending, Running, Done, Failed, Canceled };
+
+    struct Task
+    {
+        Task(QString const &name, task_type &&fn)
+            : name_(name), fn_(std::move(fn)), deps_(0), state_(Pending)
+            , start_(0), finish_(0)
+        {}
+
+        QString name_;
+        task_type fn_;
+        std::vector<task_id> dependents_;
+        size_t deps_;
+        TaskState state_;
+        qint64 start_;
+        qint64 finish_;
+        QString error_;
+    };
+
+    typedef std::chrono::steady_clock clock_type;
+
+    void checkNotStarted() const
+    {
+        if (isStarted_)
+            error::raise({{"msg", "Task graph is already started"}});
+    }
+
+    qint64 elapsed() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>
+            (clock_type::now() - started_).count();
+    }
+
+    void checkCycles() const;
+    void schedule(task_id);
+    void execute(task_id);
+    void cancelTask(task_id);
+    void complete();
+
+    Executor &executor_;
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    std::vector<Task> tasks_;
+    bool isStarted_;
+    bool isCanceled_;
+    size_t left_;
+    clock_type::time_point started_;
+    std::exception_ptr error_;
+    Promise<void> promise_;
+};
+
+void TaskGraph::State::checkCycles() const
+{
+    std::vector<size_t> deps;
+    std::vector<task_id> ready;
+    deps.reserve(tasks_.size());
+    for (task_id i = 0; i < tasks_.size(); ++i) {
+        deps.push_back(tasks_[i].deps_);
+        if (!deps[i])
+            ready.push_back(i);
+    }
+    size_t visited = 0;
+    while (!ready.empty()) {
+        auto i = ready.back();
+        ready.pop_back();
+        ++visited;
+        for (auto d : tasks_[i].dependents_) {
+            if (!--deps[d])
+                ready.push_back(d);
+        }
+    }
+    if (visited != tasks_.size())
+        error::raise({{"msg", "Dependency cycle in task graph"}});
+}
+
+Future<void> TaskGraph::State::run()
+{
+    std::vector<task_id> ready;
+    bool is_finished;
+    do {
+        std::lock_guard<std::mutex> l(mutex_);
+        checkNotStarted();
+        checkCycles();
+        isStarted_ = true;
+        started_ = clock_type::now();
+        for (task_id i = 0; i < tasks_.size(); ++i) {
+            if (!tasks_[i].deps_ && tasks_[i].state_ == Pending)
+                ready.push_back(i);
+        }
+        is_finished = !left_;
+    } while (0);
+
+    std::weak_ptr<State> wself = shared_from_this();
+    promise_.onCancel([wself]() {
+            auto self = wself.lock();
+            if (self)
+                self->cancel();
+        });
+    for (auto i : ready)
+        schedule(i);
+    if (is_finished)
+        complete();
+    return promise_.future();
+}
+
+void TaskGraph::State::schedule(task_id i)
+{
+    auto self = shared_from_this();
+    executor_.execute([self, i]() { self->execute(i); });
+}
+
+void TaskGraph::State::execute(task_id i)
+{
+    task_type fn;
+    do {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto &task = tasks_[i];
+        // canceled while queued
+        if (task.state_ != Pending)
+            return;
+        task.state_ = Running;
+        task.start_ = elapsed();
+        fn = std::move(task.fn_);
+    } while (0);
+
+    std::exception_ptr error;
+    try {
+        fn();
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    std::vector<task_id> ready;
+    bool is_finished;
+    do {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto &task = tasks_[i];
+        task.finish_ = elapsed();
+        if (error) {
+            task.state_ = Failed;
+            try {
+                std::rethrow_exception(error);
+            } catch (std::exception const &e) {
+                task.error_ = e.what();
+            } catch (...) {
+                task.error_ = "Unknown error";
+            }
+            if (!error_)
+                error_ = error;
+            for (auto d : task.dependents_)
+                cancelTask(d);
+        } else {
+            task.state_ = Done;
+            for (auto d : task.dependents_) {
+                auto &dependent = tasks_[d];
+                if (!--dependent.deps_ && dependent.state_ == Pending)
+                    ready.push_back(d);
+            }
+        }
+        is_finished = !--left_;
+    } while (0);
+
+    for (auto d : ready)
+        schedule(d);
+    if (is_finished)
+        complete();
+}
+
+void TaskGraph::State::cancelTask(task_id i)
+{
+    auto &task = tasks_[i];
+    if (task.state_ != Pending)
+        return;
+    task.state_ = Canceled;
+    task.fn_ = nullptr;
+    --left_;
+    for (auto d : task.dependents_)
+        cancelTask(d);
+}
+
+void TaskGraph::State::cancel(task_id i)
+{
+    bool is_finished;
+    do {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (i >= tasks_.size())
+            error::raise({{"msg", "Unknown task"}, {"task", (quint64)i}});
+        auto left = left_;
+        cancelTask(i);
+        if (left != left_)
+            isCanceled_ = true;
+        is_finished = isStarted_ && left != left_ && !left_;
+    } while (0);
+    if (is_finished)
+        complete();
+}
+
+void TaskGraph::State::cancel()
+{
+    bool is_finished;
+    do {
+        std::lock_guard<std::mutex> l(mutex_);
+        auto left = left_;
+        for (task_id i = 0; i < tasks_.size(); ++i)
+            cancelTask(i);
+        if (left != left_)
+            isCanceled_ = true;
+        is_finished = isStarted_ && left != left_ && !left_;
+    } while (0);
+    if (is_finished)
+        complete();
+}
+
+void TaskGraph::State::complete()
+{
+    std::exception_ptr error;
+    bool is_canceled;
+    do {
+        std::lock_guard<std::mutex> l(mutex_);
+        error = error_;
+        is_canceled = isCanceled_;
+    } while (0);
+    if (error)
+        promise_.setError(error);
+    else if (is_canceled)
+        promise_.setError({{"msg", "Canceled"}});
+    else
+        promise_.setValue();
+
+    std::lock_guard<std::mutex> l(mutex_);
+    cond_.notify_all();
+}
+
+void TaskGraph::State::wait()
+{
+    std::unique_lock<std::mutex> l(mutex_);
+    if (isStarted_)
+        cond_.wait(l, [this]() { return !left_; });
+}
+
+QVariantList TaskGraph::State::stats() const
+{
+    static char const *names[] = {
+        "pending", "running", "done", "failed", "canceled"
+    };
+    QVariantList res;
+    std::lock_guard<std::mutex> l(mutex_);
+    for (auto const &task : tasks_) {
+        QVariantMap info{{"name", task.name_}, {"state", names[task.state_]}};
+        if (task.state_ != Pending && task.state_ != Canceled) {
+            auto finish = task.state_ == Running ? elapsed() : task.finish_;
+            info["start_ms"] = task.start_ / 1e6;
+            info["duration_ms"] = (finish - task.start_) / 1e6;
+        }
+        if (task.state_ == Failed)
+            info["error"] = task.error_;
+        res.push_back(info);
+    }
+    return res;
+}
+
+TaskGraph::TaskGraph(Executor &executor)
+    : executor_(executor)
+    , state_(std::make_shared<State>(executor))
+{}
+
+TaskGraph::~TaskGraph()
+{
+    state_->cancel();
+    state_->wait();
+}
+
+TaskGraph::task_id TaskGraph::add(QString const &name, Executor::task_type fn)
+{
+    return state_->add(name, std::move(fn));
+}
+
+void TaskGraph::depends(task_id task, task_id dep)
+{
+    state_->depends(task, dep);
+}
+
+void TaskGraph::depends(task_id task, std::initializer_list<task_id> deps)
+{
+    for (auto dep : deps)
+        state_->depends(task, dep);
+}
+
+Future<void> TaskGraph::run()
+{
+    return state_->run();
+}
+
+void TaskGraph::cancel(task_id task)
+{
+    state_->cancel(task);
+}
+
+void TaskGraph::cancel()
+{
+    state_->cancel();
+}
+
+QVariantList TaskGraph::stats() const
+{
+    return state_->stats();
+}
+
+}}
@@ -0,0 +1,663 @@
+/**
+ * @file forkserver.cpp
+ * @brief Helper process spawning children on behalf of the application
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ *
+ * Forking a process with large RSS and many mappings is expensive
+ * even with CoW, so the small helper forked early spawns children
+ * instead. Requests are sent over SOCK_SEQPACKET socket together
+ * with child stdio descriptors (SCM_RIGHTS), replies are written by
+ * the server to the per-request status pipe.
+ */
+
+#include "forkserver.hpp"
+#include <qtaround/debug.hpp>
+
+#include <QFile>
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+extern char **environ;
+
+namespace qtaround { namespace subprocess {
+
+namespace forkserver {
+
+namespace {
+
+struct RequestHeader
+{
+    uint32_t nargs;
+    uint32_t nenv;
+};
+
+enum {
+    fds_count = 4
+    // bigger requests are executed w/o server
+    , max_request_size = 64 * 1024
+    // each string takes at least 1 byte (terminating zero)
+    , max_strings = max_request_size
+    // requests above the limit are executed w/o server
+    , max_children = 256
+};
+
+struct Child
+{
+    pid_t pid;
+    int status_fd;
+};
+
+/**
+ * Server memory. The server is forked from the multithreaded
+ * application, so malloc can be locked by other thread at the moment
+ * of fork. All buffers are allocated before fork and the server does
+ * not allocate memory after it.
+ */
+struct ServerState
+{
+    ServerState()
+        : buf(max_request_size)
+        , strings(max_strings + 2)
+        , children(max_children, Child{-1, -1})
+    {}
+
+    std::vector<char> buf;
+    std::vector<char*> strings;
+    std::vector<Child> children;
+};
+
+std::mutex server_mutex_;
+int server_fd_ = -1;
+pid_t server_pid_ = -1;
+
+void closeFd(int fd)
+{
+    if (fd >= 0)
+        ::close(fd);
+}
+
+ssize_t readAll(int fd, void *data, size_t len)
+{
+    auto p = static_cast<char*>(data);
+    size_t done = 0;
+    while (done < len) {
+        auto n = ::read(fd, p + done, len - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    return done;
+}
+
+void sendReply(int fd, ReplyType type, int32_t value
+               , struct rusage const *usage = nullptr)
+{
+    Reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = static_cast<int32_t>(type);
+    reply.value = value;
+    if (usage)
+        reply.usage = *usage;
+    // sizeof(Reply) < PIPE_BUF, so it is written atomically
+    while (::write(fd, &reply, sizeof(reply)) < 0 && errno == EINTR) {}
+}
+
+// Server side. It is executed in the forked helper, so only plain
+// POSIX calls and memory from ServerState are used below
+
+struct LinuxDirent64
+{
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+void closeFdsExcept(int keep)
+{
+    // opendir allocates memory, so entries are read directly
+    auto dir = ::open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir < 0) {
+        for (int fd = 3, end = ::sysconf(_SC_OPEN_MAX); fd < end; ++fd)
+            if (fd != keep)
+                ::close(fd);
+        return;
+    }
+    alignas(LinuxDirent64) char buf[4096];
+    while (true) {
+        auto n = ::syscall(SYS_getdents64, dir, buf, sizeof(buf));
+        if (n <= 0)
+            break;
+        for (long pos = 0; pos < n;) {
+            auto entry = reinterpret_cast<LinuxDirent64*>(buf + pos);
+            pos += entry->d_reclen;
+            char *end = nullptr;
+            auto fd = ::strtol(entry->d_name, &end, 10);
+            if (*end || end == entry->d_name)
+                continue;
+            if (fd > 2 && fd != keep && fd != dir)
+                ::close(fd);
+        }
+    }
+    ::close(dir);
+}
+
+pid_t spawnChild(char **argv, char **envp
+                 , char const *cwd, int const *fds, int &err)
+{
+    int err_pipe[2];
+    if (::pipe2(err_pipe, O_CLOEXEC) < 0) {
+        err = errno;
+        return -1;
+    }
+    auto pid = ::fork();
+    if (!pid) {
+        ::close(err_pipe[0]);
+        // received descriptors are > 2 because the server keeps
+        // 0..2 open, so dup2 can't clobber them
+        for (int i = 0; i < 3; ++i)
+            ::dup2(fds[i], i);
+        sigset_t mask;
+        ::sigemptyset(&mask);
+        ::sigprocmask(SIG_SETMASK, &mask, nullptr);
+        ::signal(SIGPIPE, SIG_DFL);
+        if (!*cwd || ::chdir(cwd) == 0)
+            ::execvpe(argv[0], argv, envp);
+        int e = errno;
+        while (::write(err_pipe[1], &e, sizeof(e)) < 0 && errno == EINTR) {}
+        ::_exit(127);
+    }
+    ::close(err_pipe[1]);
+    if (pid < 0) {
+        err = errno;
+        ::close(err_pipe[0]);
+        return -1;
+    }
+    int e = 0;
+    auto n = readAll(err_pipe[0], &e, sizeof(e));
+    ::close(err_pipe[0]);
+    if (n == sizeof(e)) {
+        // exec is failed
+        while (::waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+        err = e;
+        return -1;
+    }
+    return pid;
+}
+
+char *nextString(char *&pos, char *end)
+{
+    if (pos >= end)
+        return nullptr;
+    auto zero = static_cast<char*>(::memchr(pos, 0, end - pos));
+    if (!zero)
+        return nullptr;
+    auto res = pos;
+    pos = zero + 1;
+    return res;
+}
+
+/**
+ * @return false if the control socket is closed
+ */
+bool handleRequest(int ctrl, ServerState &state)
+{
+    auto &buf = state.buf;
+    int fds[fds_count];
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } ctl;
+    struct iovec iov;
+    iov.iov_base = buf.data();
+    iov.iov_len = buf.size();
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctl.buf;
+    msg.msg_controllen = sizeof(ctl.buf);
+
+    auto n = ::recvmsg(ctrl, &msg, MSG_CMSG_CLOEXEC);
+    if (n < 0)
+        return (errno == EINTR || errno == EAGAIN);
+    if (n == 0)
+        return false;
+
+    size_t nfds = 0;
+    for (auto c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+            continue;
+        nfds = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        // control buffer fits fds_count descriptors, the rest is
+        // truncated
+        memcpy(fds, CMSG_DATA(c), std::min<size_t>(nfds, fds_count) * sizeof(int));
+        if (nfds != fds_count) {
+            for (size_t i = 0; i < nfds && i < fds_count; ++i)
+                ::close(fds[i]);
+        }
+    }
+    if (nfds != fds_count)
+        return true;
+
+    auto status_fd = fds[fds_count - 1];
+    auto closeStdio = [&fds]() {
+        for (int i = 0; i < 3; ++i)
+            ::close(fds[i]);
+    };
+
+    RequestHeader hdr;
+    auto pos = buf.data(), end = buf.data() + n;
+    if ((msg.msg_flags & MSG_TRUNC) || (size_t)n < sizeof(hdr)) {
+        sendReply(status_fd, ReplyType::Failed, E2BIG);
+        closeStdio();
+        ::close(status_fd);
+        return true;
+    }
+    memcpy(&hdr, pos, sizeof(hdr));
+    pos += sizeof(hdr);
+
+    auto cwd = nextString(pos, end);
+    // cmd, args, nullptr, env, nullptr
+    size_t nstrings = size_t(hdr.nargs) + hdr.nenv + 3;
+    bool is_ok = cwd && nstrings <= state.strings.size();
+    auto argv = state.strings.data();
+    auto envp = argv + (is_ok ? hdr.nargs + 2 : 0);
+    for (uint32_t i = 0; is_ok && i < hdr.nargs + 1; ++i) {
+        argv[i] = nextString(pos, end);
+        is_ok = !!argv[i];
+    }
+    for (uint32_t i = 0; is_ok && i < hdr.nenv; ++i) {
+        envp[i] = nextString(pos, end);
+        is_ok = !!envp[i];
+    }
+    if (is_ok) {
+        argv[hdr.nargs + 1] = nullptr;
+        envp[hdr.nenv] = nullptr;
+    }
+
+    auto child = state.children.end();
+    for (auto it = state.children.begin(); it != state.children.end(); ++it) {
+        if (it->pid < 0) {
+            child = it;
+            break;
+        }
+    }
+
+    int err = is_ok ? EAGAIN : EINVAL;
+    auto pid = (is_ok && child != state.children.end())
+        ? spawnChild(argv, envp, cwd, fds, err) : -1;
+    closeStdio();
+    if (pid < 0) {
+        sendReply(status_fd, ReplyType::Failed, err);
+        ::close(status_fd);
+    } else {
+        sendReply(status_fd, ReplyType::Started, pid);
+        *child = Child{pid, status_fd};
+    }
+    return true;
+}
+
+void reapChildren(std::vector<Child> &children)
+{
+    while (true) {
+        int status = 0;
+        struct rusage usage;
+        auto pid = ::wait4(-1, &status, WNOHANG, &usage);
+        if (pid < 0 && errno == EINTR)
+            continue;
+        if (pid <= 0)
+            break;
+        for (auto &child : children) {
+            if (child.pid != pid)
+                continue;
+            sendReply(child.status_fd, ReplyType::Exited, status, &usage);
+            ::close(child.status_fd);
+            child = Child{-1, -1};
+            break;
+        }
+    }
+}
+
+void serve(int ctrl, pid_t parent, ServerState &state)
+{
+    // signal is sent when the forking thread exits, so the server is
+    // forked from the main thread only, see startForkServer()
+    ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (::getppid() != parent)
+        return;
+
+    closeFdsExcept(ctrl);
+    for (int fd = 0; fd < 3; ++fd) {
+        if (::fcntl(fd, F_GETFD) < 0) {
+            auto null_fd = ::open("/dev/null", O_RDWR);
+            if (null_fd >= 0 && null_fd != fd) {
+                ::dup2(null_fd, fd);
+                ::close(null_fd);
+            }
+        }
+    }
+
+    sigset_t mask;
+    ::sigemptyset(&mask);
+    ::sigaddset(&mask, SIGCHLD);
+    ::sigprocmask(SIG_BLOCK, &mask, nullptr);
+    ::signal(SIGPIPE, SIG_IGN);
+    auto sig_fd = ::signalfd(-1, &mask, SFD_CLOEXEC);
+    if (sig_fd < 0)
+        return;
+
+    struct pollfd pfds[2] = {{ctrl, POLLIN, 0}, {sig_fd, POLLIN, 0}};
+    while (true) {
+        auto rc = ::poll(pfds, 2, -1);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfds[1].revents & POLLIN) {
+            struct signalfd_siginfo info[8];
+            while (::read(sig_fd, info, sizeof(info)) < 0 && errno == EINTR) {}
+            reapChildren(state.children);
+        }
+        if (pfds[0].revents & POLLIN) {
+            if (!handleRequest(ctrl, state))
+                break;
+        } else if (pfds[0].revents & (POLLHUP | POLLERR)) {
+            break;
+        }
+    }
+}
+
+void readOutput(int out, int err, QByteArray &out_data, QByteArray &err_data)
+{
+    struct pollfd pfds[2] = {{out, POLLIN, 0}, {err, POLLIN, 0}};
+    QByteArray *dst[2] = {&out_data, &err_data};
+    char buf[64 * 1024];
+    int active = 2;
+    while (active) {
+        auto rc = ::poll(pfds, 2, -1);
+        if (rc < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (int i = 0; i < 2; ++i) {
+            if (!pfds[i].revents)
+                continue;
+            auto n = ::read(pfds[i].fd, buf, sizeof(buf));
+            if (n < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+            if (n <= 0) {
+                // negative fd is ignored by poll
+                pfds[i].fd = -1;
+                --active;
+                continue;
+            }
+            dst[i]->append(buf, n);
+        }
+    }
+}
+
+/**
+ * Called with server_mutex_ locked. Server is not waited here to
+ * avoid blocking other threads, caller should pass returned pid to
+ * waitServer() after unlocking the mutex.
+ *
+ * @return server pid or -1 if fd is not current server socket
+ */
+pid_t resetServer(int fd)
+{
+    if (fd != server_fd_)
+        return -1;
+    ::close(server_fd_);
+    server_fd_ = -1;
+    auto pid = server_pid_;
+    server_pid_ = -1;
+    return pid;
+}
+
+void waitServer(pid_t pid)
+{
+    if (pid > 0)
+        while (::waitpid(pid, nullptr, 0) < 0 && errno == EINTR) {}
+}
+
+} // namespace
+
+bool spawn(QString const &cmd, QStringList const &args, QString const &cwd
+           , int const (&fds)[3], int &status_fd)
+{
+    QByteArray msg;
+    RequestHeader hdr;
+    hdr.nargs = args.size();
+    hdr.nenv = 0;
+    msg.append(reinterpret_cast<char const*>(&hdr), sizeof(hdr));
+    auto add = [&msg](QByteArray const &s) {
+        msg.append(s);
+        msg.append('\0');
+    };
+    add(QFile::encodeName(cwd));
+    add(QFile::encodeName(cmd));
+    for (auto const &arg : args)
+        add(arg.toLocal8Bit());
+    for (auto env = environ; env && *env; ++env, ++hdr.nenv)
+        add(QByteArray(*env));
+    if (msg.size() > max_request_size)
+        return false;
+    memcpy(msg.data(), &hdr, sizeof(hdr));
+
+    int status_pipe[2];
+    if (::pipe2(status_pipe, O_CLOEXEC) < 0)
+        return false;
+
+    int send_fds[fds_count] = {fds[0], fds[1], fds[2], status_pipe[1]};
+    union {
+        char buf[CMSG_SPACE(sizeof(send_fds))];
+        struct cmsghdr align;
+    } ctl;
+    memset(&ctl, 0, sizeof(ctl));
+    struct iovec iov;
+    iov.iov_base = msg.data();
+    iov.iov_len = msg.size();
+    struct msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+    auto c = CMSG_FIRSTHDR(&mh);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(send_fds));
+    memcpy(CMSG_DATA(c), send_fds, sizeof(send_fds));
+
+    ssize_t n = -1;
+    pid_t gone_pid = -1;
+    do {
+        std::lock_guard<std::mutex> l(server_mutex_);
+        if (server_fd_ < 0)
+            break;
+        do {
+            n = ::sendmsg(server_fd_, &mh, MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0 && errno != EMSGSIZE && errno != ENOBUFS) {
+            debug::warning("Fork server is gone:", ::strerror(errno));
+            gone_pid = resetServer(server_fd_);
+        }
+    } while (0);
+    waitServer(gone_pid);
+
+    ::close(status_pipe[1]);
+    if (n < 0) {
+        ::close(status_pipe[0]);
+        return false;
+    }
+    status_fd = status_pipe[0];
+    return true;
+}
+
+bool readReply(int status_fd, Reply &reply)
+{
+    return readAll(status_fd, &reply, sizeof(reply)) == sizeof(reply);
+}
+
+int replyRc(Reply const &reply)
+{
+    // the same as Process::rc() for failed/crashed process
+    if (static_cast<ReplyType>(reply.type) != ReplyType::Exited
+        || !WIFEXITED(reply.value))
+        return 254;
+    return WEXITSTATUS(reply.value);
+}
+
+QString replyInfo(Reply const &reply)
+{
+    switch (static_cast<ReplyType>(reply.type)) {
+    case ReplyType::Failed:
+        return "FailedToStart";
+    case ReplyType::Exited:
+        return WIFEXITED(reply.value) ? QString() : QString("Crashed");
+    default:
+        return QString();
+    }
+}
+
+bool run(QString const &cmd, QStringList const &args, QString const &cwd
+         , Result &res)
+{
+    if (!isForkServerRunning())
+        return false;
+
+    int out[2] = {-1, -1}, err[2] = {-1, -1};
+    auto in = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    auto closeAll = [&]() {
+        for (auto fd : {in, out[0], out[1], err[0], err[1]})
+            closeFd(fd);
+    };
+    if (in < 0 || ::pipe2(out, O_CLOEXEC) < 0 || ::pipe2(err, O_CLOEXEC) < 0) {
+        closeAll();
+        return false;
+    }
+
+    int status = -1;
+    int const fds[3] = {in, out[1], err[1]};
+    if (!spawn(cmd, args, cwd, fds, status)) {
+        closeAll();
+        return false;
+    }
+    for (auto &fd : {&in, &out[1], &err[1]}) {
+        ::close(*fd);
+        *fd = -1;
+    }
+
+    debug::info("Start", cmd, args, "using fork server");
+    Reply reply;
+    res = Result();
+    if (!readReply(status, reply)) {
+        reply.type = static_cast<int32_t>(ReplyType::Failed);
+        reply.value = EPIPE;
+    }
+    if (static_cast<ReplyType>(reply.type) == ReplyType::Failed
+        && reply.value == EAGAIN) {
+        // server children table is full
+        closeFd(status);
+        closeAll();
+        return false;
+    }
+    if (static_cast<ReplyType>(reply.type) == ReplyType::Started) {
+        readOutput(out[0], err[0], res.stdout, res.stderr);
+        if (!readReply(status, reply)) {
+            reply.type = static_cast<int32_t>(ReplyType::Failed);
+            reply.value = EPIPE;
+        }
+    }
+    if (static_cast<ReplyType>(reply.type) == ReplyType::Failed) {
+        debug::warning("Process is failed to start", cmd, ::strerror(reply.value));
+        res.stderr.append(::strerror(reply.value));
+    }
+    res.rc = replyRc(reply);
+    res.info = replyInfo(reply);
+    debug::info("Process is finished", res.rc);
+    closeFd(status);
+    closeAll();
+    return true;
+}
+
+} // forkserver
+
+bool startForkServer()
+{
+    if (::syscall(SYS_gettid) != ::getpid()) {
+        // PR_SET_PDEATHSIG is bound to the forking thread
+        debug::warning("Fork server can be started only from the main thread");
+        return false;
+    }
+    std::lock_guard<std::mutex> l(forkserver::server_mutex_);
+    if (forkserver::server_fd_ >= 0)
+        return true;
+
+    int sv[2];
+    if (::socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0) {
+        debug::warning("Can't create fork server socket:", ::strerror(errno));
+        return false;
+    }
+    auto parent = ::getpid();
+    std::unique_ptr<forkserver::ServerState> state
+        (new forkserver::ServerState());
+    auto pid = ::fork();
+    if (!pid) {
+        ::close(sv[0]);
+        forkserver::serve(sv[1], parent, *state);
+        ::_exit(0);
+    }
+    ::close(sv[1]);
+    if (pid < 0) {
+        debug::warning("Can't fork server:", ::strerror(errno));
+        ::close(sv[0]);
+        return false;
+    }
+    forkserver::server_fd_ = sv[0];
+    forkserver::server_pid_ = pid;
+    debug::info("Fork server is started, pid", pid);
+    return true;
+}
+
+void stopForkServer()
+{
+    pid_t pid = -1;
+    {
+        std::lock_guard<std::mutex> l(forkserver::server_mutex_);
+        if (forkserver::server_fd_ >= 0)
+            pid = forkserver::resetServer(forkserver::server_fd_);
+    }
+    forkserver::waitServer(pid);
+}
+
+bool isForkServerRunning()
+{
+    std::lock_guard<std::mutex> l(forkserver::server_mutex_);
+    return forkserver::server_fd_ >= 0;
+}
+
+}}
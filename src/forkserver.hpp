@@ -0,0 +1,62 @@
+#ifndef _QTAROUND_FORKSERVER_HPP_
+#define _QTAROUND_FORKSERVER_HPP_
+/**
+ * @file forkserver.hpp
+ * @brief Fork server client interface used by the subprocess implementation
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <qtaround/subprocess.hpp>
+
+#include <sys/resource.h>
+#include <stdint.h>
+
+namespace qtaround { namespace subprocess { namespace forkserver {
+
+enum class ReplyType : int32_t {
+    Started = 1, // value = pid
+    Failed, // value = errno
+    Exited // value = wait status, usage is filled
+};
+
+struct Reply
+{
+    int32_t type;
+    int32_t value;
+    struct rusage usage;
+};
+
+/**
+ * Asks the fork server to spawn cmd with child stdin/stdout/stderr
+ * set to fds. On success status_fd is the read end of the channel
+ * the server sends Reply records to: first Started or Failed, later
+ * Exited. Caller closes fds and status_fd.
+ *
+ * @return false if the server is not running or the request can't
+ * be sent
+ */
+bool spawn(QString const &cmd, QStringList const &args, QString const &cwd
+           , int const (&fds)[3], int &status_fd);
+
+/// blocking read of the next reply, false on EOF or error
+bool readReply(int status_fd, Reply &);
+
+/// convert Exited/Failed reply to the process return code
+int replyRc(Reply const &);
+
+/// the same as Process::errorInfo() for failed/crashed process
+QString replyInfo(Reply const &);
+
+/**
+ * Run process through the fork server, collecting its stdout and
+ * stderr. stdin is connected to /dev/null.
+ *
+ * @return false if the server is not running
+ */
+bool run(QString const &cmd, QStringList const &args, QString const &cwd
+         , Result &res);
+
+}}}
+
+#endif // _QTAROUND_FORKSERVER_HPP_
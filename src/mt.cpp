@@ -7,12 +7,1014 @@
 
 #include <qtaround/debug.hpp>
 #include <qtaround/mt.hpp>
+#include <qtaround/future.hpp>
+#include <qtaround/executor.hpp>
+#include "timerwheel.hpp"
+#include <QSocketNotifier>
+#include <QHash>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include <array>
+#include <chrono>
+#include <deque>
 #include <mutex>
+#include <thread>
 #include <condition_variable>
+#include <limits>
+#include <vector>
+
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
 
 namespace qtaround { namespace mt {
 
+void invokeLater(QObject *context, std::function<void()> fn)
+{
+    // queued connection to the temporary object destroyed signal is
+    // delivered in the context thread
+    QObject src;
+    QObject::connect(&src, &QObject::destroyed, context
+                     , [fn](QObject*) { fn(); }, Qt::QueuedConnection);
+}
+
+namespace {
+
+qint64 nowNs()
+{
+    using namespace std::chrono;
+    return duration_cast<nanoseconds>
+        (steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+/**
+ * Histogram with log2 buckets, bucket i counts values in [2^(i-1),
+ * 2^i)
+ */
+class Histogram
+{
+public:
+    Histogram()
+    {
+        for (auto &v : buckets_)
+            v = 0;
+    }
+
+    void add(quint64 v)
+    {
+        size_t i = 0;
+        for (; v && i < buckets_count - 1; v >>= 1)
+            ++i;
+        ++buckets_[i];
+    }
+
+    QVariantMap toMap() const;
+
+private:
+    static const size_t buckets_count = 40;
+    std::array<std::atomic<quint64>, buckets_count> buckets_;
+};
+
+QVariantMap Histogram::toMap() const
+{
+    std::array<quint64, buckets_count> counts;
+    quint64 total = 0;
+    size_t last = 0;
+    for (size_t i = 0; i < buckets_count; ++i) {
+        counts[i] = buckets_[i];
+        total += counts[i];
+        if (counts[i])
+            last = i;
+    }
+    auto upper_bound = [](size_t i) -> quint64 {
+        return i ? (1ULL << i) - 1 : 0;
+    };
+    auto percentile = [&](double p) -> quint64 {
+        quint64 sum = 0;
+        for (size_t i = 0; i < buckets_count; ++i) {
+            sum += counts[i];
+            if (sum && sum >= p * total)
+                return upper_bound(i);
+        }
+        return 0;
+    };
+    QVariantList buckets;
+    for (size_t i = 0; total && i <= last; ++i)
+        buckets.push_back(counts[i]);
+    return {{"count", total}
+        , {"p50", percentile(0.5)}
+        , {"p90", percentile(0.9)}
+        , {"p99", percentile(0.99)}
+        , {"max", total ? upper_bound(last) : 0}
+        , {"buckets", buckets}};
+}
+
+class ActorMetrics
+{
+public:
+    ActorMetrics()
+        : isEnabled_(false), started_(nowNs()), peakDepth_(0)
+        , processed_(0), dropped_(0), rejected_(0), undelivered_(0)
+        , coalesced_(0), busyNs_(0)
+    {}
+
+    bool isEnabled() const { return isEnabled_; }
+    void setEnabled(bool v) { isEnabled_ = v; }
+
+    void depth(size_t v)
+    {
+        auto peak = peakDepth_.load();
+        while (v > peak && !peakDepth_.compare_exchange_weak(peak, v)) {}
+    }
+
+    void dropped() { ++dropped_; }
+    void rejected() { ++rejected_; }
+    void undelivered(size_t n) { undelivered_ += n; }
+    void coalesced(size_t n) { coalesced_ += n; }
+
+    /// message is taken from the mailbox
+    void dequeued(qint64 enqueued, qint64 now)
+    {
+        latency_.add(std::max<qint64>(0, now - enqueued) / 1000);
+    }
+
+    /// messages are handled in duration_ns
+    void handled(size_t count, qint64 duration_ns)
+    {
+        processed_ += count;
+        busyNs_ += duration_ns;
+        runTime_.add(duration_ns / 1000);
+    }
+
+    QVariantMap toMap(size_t depth) const;
+
+private:
+    bool isEnabled_;
+    qint64 started_;
+    std::atomic<size_t> peakDepth_;
+    std::atomic<quint64> processed_;
+    std::atomic<quint64> dropped_;
+    std::atomic<quint64> rejected_;
+    std::atomic<quint64> undelivered_;
+    std::atomic<quint64> coalesced_;
+    std::atomic<qint64> busyNs_;
+    Histogram latency_;
+    Histogram runTime_;
+};
+
+QVariantMap ActorMetrics::toMap(size_t depth) const
+{
+    QVariantMap res{{"depth", (quint64)depth}
+        , {"dropped", (quint64)dropped_}
+        , {"rejected", (quint64)rejected_}
+        , {"undelivered", (quint64)undelivered_}};
+    if (!isEnabled_)
+        return res;
+    auto uptime = nowNs() - started_;
+    res["peak_depth"] = (quint64)peakDepth_;
+    res["processed"] = (quint64)processed_;
+    res["coalesced"] = (quint64)coalesced_;
+    res["uptime_ms"] = uptime / 1000000;
+    res["busy"] = uptime > 0 ? (double)busyNs_ / uptime : 0.0;
+    res["latency_us"] = latency_.toMap();
+    res["run_time_us"] = runTime_.toMap();
+    return res;
+}
+
+/// messages used by the actor implementation itself
+class ServiceMessage : public Message
+{
+};
+
+/**
+ * Intrusive multi-producer single-consumer queue (D.Vyukov). Producers
+ * are wait-free, consumer is lock-free.
+ *
+ * Optionally mailbox is bounded: producer reserves space before
+ * pushing the message and overflow is handled according to the
+ * selected policy. Dropping the oldest message makes producer a
+ * consumer too, so in this mode queue is popped under the lock. Service
+ * messages are never dropped, they are kept aside in the same order
+ * and popped first.
+ */
+class Mailbox
+{
+public:
+    enum class Overflow { Block, Fail, DropOldest };
+
+    /// true when high water mark is reached, false on low water mark
+    typedef std::function<void(bool)> water_callback_type;
+
+    Mailbox()
+        : head_(&stub_), tail_(&stub_), scheduled_(false)
+        , size_(0), capacity_(0), overflow_(Overflow::Block)
+        , highWater_(0), lowWater_(0), isAboveHigh_(false)
+        , blocked_(0), isClosed_(false), producers_(0)
+    {}
+
+    ~Mailbox()
+    {
+        for (auto m : kept_)
+            delete m;
+        while (auto m = take())
+            delete m;
+    }
+
+    /**
+     * Options: capacity (0 - unbounded), overflow (block, fail,
+     * drop_oldest), high_water (capacity by default), low_water (half
+     * of high_water by default)
+     */
+    void configure(QVariantMap const &, water_callback_type);
+
+    /**
+     * Producer reserves space for the message before pushing it. If
+     * it is not allowed to block (posting to itself) overflow is
+     * allowed in the blocking mode. Successful reservation should be
+     * followed by push()
+     *
+     * @return false if message should be rejected
+     */
+    bool reserve(bool can_block);
+
+    /**
+     * Reserve space without blocking and overflowing the mailbox in
+     * the blocking mode, for messages posted by timers. If there is no
+     * space message is dropped
+     */
+    bool reserveNoWait();
+
+    /// reserve space ignoring limits, for service messages
+    void reserveForced()
+    {
+        ++producers_;
+        ++size_;
+    }
+
+    /// @return true if consumer should be woken up
+    bool push(Message *m)
+    {
+        if (metrics_.isEnabled()) {
+            m->enqueued_ = nowNs();
+            metrics_.depth(size_);
+        }
+        enqueue(m);
+        --producers_;
+        return !scheduled_.exchange(true);
+    }
+
+    /// consumer calls it before draining the queue
+    void resetScheduled()
+    {
+        scheduled_.store(false);
+    }
+
+    /**
+     * Consumer calls it after draining the queue if it can't be
+     * woken up in other way.
+     *
+     * @return true if messages were pushed meanwhile and consumer
+     * should be rescheduled
+     */
+    bool rearm()
+    {
+        scheduled_.store(false);
+        return !isEmpty() && !scheduled_.exchange(true);
+    }
+
+    /// consumer only
+    bool isEmpty()
+    {
+        std::unique_lock<std::mutex> l(popMutex_, std::defer_lock);
+        if (overflow_ == Overflow::DropOldest)
+            l.lock();
+        return kept_.empty() && tail_ == &stub_
+            && !stub_.next_.load(std::memory_order_acquire);
+    }
+
+    Message *pop();
+
+    /// wake up blocked producers, all following posts are rejected
+    void close();
+
+    /**
+     * Consumer only: delete messages left in the closed mailbox
+     * including ones being pushed by producers reserved space before
+     * closing. All but service messages are counted as undelivered
+     */
+    void discard();
+
+    size_t size() const { return size_; }
+    bool isClosed() const { return isClosed_; }
+
+    ActorMetrics &metrics() { return metrics_; }
+    ActorMetrics const &metrics() const { return metrics_; }
+
+private:
+    class Stub : public Message
+    {
+        void deliver(QObject *) {}
+    };
+
+    void enqueue(Message *m)
+    {
+        m->next_.store(nullptr, std::memory_order_relaxed);
+        auto prev = head_.exchange(m, std::memory_order_acq_rel);
+        prev->next_.store(m, std::memory_order_release);
+    }
+
+    Message *take()
+    {
+        auto tail = tail_;
+        auto next = tail->next_.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next)
+                return nullptr;
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        if (tail != head_.load(std::memory_order_acquire))
+            return nullptr; // producer is in the middle of push
+        enqueue(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    /**
+     * Increment size if it is below capacity
+     *
+     * @return new size or 0 if mailbox is full
+     */
+    size_t tryAcquire()
+    {
+        auto size = size_.load();
+        do {
+            if (capacity_ && size >= capacity_)
+                return 0;
+        } while (!size_.compare_exchange_weak(size, size + 1));
+        return size + 1;
+    }
+
+    bool reserveSpace(bool can_block);
+    bool reserveSpaceNoWait();
+
+    /// drop the oldest message, only called under popMutex_
+    bool dropOldest();
+
+    void reserved(size_t size);
+
+    void released(size_t size);
+
+    std::atomic<Message*> head_;
+    Message *tail_;
+    Stub stub_;
+    std::atomic<bool> scheduled_;
+
+    std::atomic<size_t> size_;
+    size_t capacity_;
+    Overflow overflow_;
+    size_t highWater_;
+    size_t lowWater_;
+    std::atomic<bool> isAboveHigh_;
+    water_callback_type onWater_;
+
+    std::mutex popMutex_;
+    // service messages taken while dropping the oldest one
+    std::deque<Message*> kept_;
+    std::mutex spaceMutex_;
+    std::condition_variable spaceCond_;
+    std::atomic<size_t> blocked_;
+    std::atomic<bool> isClosed_;
+    // producers between reserving space and pushing the message
+    std::atomic<size_t> producers_;
+
+    ActorMetrics metrics_;
+};
+
+void Mailbox::configure(QVariantMap const &options, water_callback_type fn)
+{
+    capacity_ = options.value("capacity", 0).toUInt();
+    auto overflow = options.value("overflow", "block").toString();
+    if (overflow == "block")
+        overflow_ = Overflow::Block;
+    else if (overflow == "fail")
+        overflow_ = Overflow::Fail;
+    else if (overflow == "drop_oldest")
+        overflow_ = Overflow::DropOldest;
+    else
+        error::raise({{"msg", "Unknown mailbox overflow policy"}
+                , {"overflow", overflow}});
+    highWater_ = options.value("high_water", (uint)capacity_).toUInt();
+    lowWater_ = options.value("low_water", (uint)highWater_ / 2).toUInt();
+    if (highWater_ && lowWater_ >= highWater_)
+        error::raise({{"msg", "Low water mark should be below high water"}
+                , {"high_water", (uint)highWater_}
+                , {"low_water", (uint)lowWater_}});
+    onWater_ = std::move(fn);
+    metrics_.setEnabled(options.value("metrics").toBool()
+                        || options.contains("metrics_dump"));
+}
+
+bool Mailbox::reserve(bool can_block)
+{
+    // producer is counted before checking isClosed_, so discard()
+    // waits for its message after closing
+    ++producers_;
+    if (reserveSpace(can_block))
+        return true;
+    --producers_;
+    return false;
+}
+
+bool Mailbox::reserveNoWait()
+{
+    ++producers_;
+    if (reserveSpaceNoWait())
+        return true;
+    --producers_;
+    return false;
+}
+
+bool Mailbox::reserveSpace(bool can_block)
+{
+    if (isClosed_) {
+        metrics_.rejected();
+        return false;
+    }
+    auto size = tryAcquire();
+    if (!size) {
+        switch (overflow_) {
+        case Overflow::Fail:
+            metrics_.rejected();
+            return false;
+        case Overflow::DropOldest: {
+            size = ++size_;
+            std::lock_guard<std::mutex> l(popMutex_);
+            if (dropOldest()) {
+                size = --size_;
+                metrics_.dropped();
+            }
+            break;
+        }
+        case Overflow::Block: {
+            if (!can_block) {
+                size = ++size_;
+                break;
+            }
+            // space is acquired only when it is really available, so
+            // blocked producers do not inflate the size
+            std::unique_lock<std::mutex> l(spaceMutex_);
+            ++blocked_;
+            spaceCond_.wait(l, [this, &size]() {
+                    return isClosed_ || (size = tryAcquire());
+                });
+            --blocked_;
+            if (!size) {
+                metrics_.rejected();
+                return false;
+            }
+            break;
+        }
+        }
+    }
+    reserved(size);
+    return true;
+}
+
+bool Mailbox::reserveSpaceNoWait()
+{
+    if (overflow_ != Overflow::Block)
+        return reserveSpace(false);
+    if (isClosed_) {
+        metrics_.rejected();
+        return false;
+    }
+    auto size = tryAcquire();
+    if (!size) {
+        metrics_.dropped();
+        return false;
+    }
+    reserved(size);
+    return true;
+}
+
+void Mailbox::reserved(size_t size)
+{
+    if (highWater_ && size >= highWater_ && !isAboveHigh_.exchange(true)) {
+        if (onWater_)
+            onWater_(true);
+    }
+}
+
+bool Mailbox::dropOldest()
+{
+    while (auto m = take()) {
+        if (dynamic_cast<ServiceMessage*>(m)) {
+            kept_.push_back(m);
+            continue;
+        }
+        delete m;
+        return true;
+    }
+    return false;
+}
+
+Message *Mailbox::pop()
+{
+    std::unique_lock<std::mutex> l(popMutex_, std::defer_lock);
+    if (overflow_ == Overflow::DropOldest)
+        l.lock();
+    Message *m = nullptr;
+    if (!kept_.empty()) {
+        m = kept_.front();
+        kept_.pop_front();
+    } else {
+        m = take();
+    }
+    if (l.owns_lock())
+        l.unlock();
+    if (m)
+        released(--size_);
+    return m;
+}
+
+void Mailbox::released(size_t size)
+{
+    if (blocked_) {
+        std::lock_guard<std::mutex> l(spaceMutex_);
+        spaceCond_.notify_all();
+    }
+    if (isAboveHigh_ && size <= lowWater_ && isAboveHigh_.exchange(false)) {
+        if (onWater_)
+            onWater_(false);
+    }
+}
+
+void Mailbox::close()
+{
+    std::lock_guard<std::mutex> l(spaceMutex_);
+    isClosed_ = true;
+    spaceCond_.notify_all();
+}
+
+void Mailbox::discard()
+{
+    // blocked producers are woken up by close() and rejected, others
+    // are finishing push()
+    while (producers_)
+        std::this_thread::yield();
+    size_t count = 0;
+    while (auto m = pop()) {
+        if (!dynamic_cast<ServiceMessage*>(m))
+            ++count;
+        delete m;
+    }
+    if (count) {
+        debug::debug("Actor is finished, undelivered messages:", count);
+        metrics_.undelivered(count);
+    }
+}
+
+namespace {
+
+class EventMessage : public Message
+{
+public:
+    EventMessage(QEvent *e) : e_(e) {}
+    ~EventMessage() { delete e_; }
+
+    void deliver(QObject *obj)
+    {
+        QCoreApplication::sendEvent(obj, e_);
+    }
+
+private:
+    QEvent *e_;
+};
+
+void deliver(Message *m, QObject *obj)
+{
+    try {
+        m->deliver(obj);
+    } catch (std::exception const &e) {
+        debug::warning("Actor message handler exception:", e.what());
+    }
+}
+
+}
+
+/**
+ * Takes messages from the mailbox and delivers them to the actor
+ * object one by one or in batches
+ */
+class Dispatcher
+{
+public:
+    Dispatcher() : batchSize_(0) {}
+
+    void configure(QVariantMap const &options)
+    {
+        batchSize_ = options.value("batch", 0).toUInt();
+    }
+
+    /**
+     * Process up to limit messages, stop after service message if
+     * is_stopped is set
+     *
+     * @return number of messages taken from the mailbox
+     */
+    size_t dispatch(Mailbox &, QObject *, size_t limit
+                    , bool const &is_stopped);
+
+private:
+    typedef std::vector<std::unique_ptr<Message> > batch_type;
+
+    void deliverOne(Message *, QObject *, ActorMetrics &);
+    void deliverBatch(batch_type &, QObject *, ActorMetrics &);
+
+    size_t batchSize_;
+};
+
+size_t Dispatcher::dispatch(Mailbox &mailbox, QObject *obj, size_t limit
+                            , bool const &is_stopped)
+{
+    size_t count = 0;
+    if (!batchSize_) {
+        while (count < limit && !is_stopped) {
+            std::unique_ptr<Message> m(mailbox.pop());
+            if (!m)
+                break;
+            ++count;
+            deliverOne(m.get(), obj, mailbox.metrics());
+        }
+        return count;
+    }
+
+    batch_type batch;
+    batch.reserve(batchSize_);
+    while (count < limit && !is_stopped) {
+        // service message is a barrier: it is delivered after the
+        // batch collected before it
+        std::unique_ptr<Message> service;
+        while (batch.size() < batchSize_ && count < limit) {
+            std::unique_ptr<Message> m(mailbox.pop());
+            if (!m)
+                break;
+            ++count;
+            if (dynamic_cast<ServiceMessage*>(m.get())) {
+                service = std::move(m);
+                break;
+            }
+            batch.push_back(std::move(m));
+        }
+        if (batch.empty() && !service)
+            break;
+        deliverBatch(batch, obj, mailbox.metrics());
+        batch.clear();
+        if (service)
+            deliverOne(service.get(), obj, mailbox.metrics());
+    }
+    return count;
+}
+
+void Dispatcher::deliverOne(Message *m, QObject *obj, ActorMetrics &metrics)
+{
+    if (!metrics.isEnabled()) {
+        deliver(m, obj);
+        return;
+    }
+    auto start = nowNs();
+    metrics.dequeued(m->enqueued_, start);
+    deliver(m, obj);
+    metrics.handled(1, nowNs() - start);
+}
+
+void Dispatcher::deliverBatch(batch_type &batch, QObject *obj
+                              , ActorMetrics &metrics)
+{
+    if (batch.empty())
+        return;
+
+    QHash<QString, size_t> newest;
+    size_t keyed_count = 0;
+    for (size_t i = 0; i < batch.size(); ++i) {
+        auto const &key = batch[i]->key();
+        if (!key.isEmpty()) {
+            newest[key] = i;
+            ++keyed_count;
+        }
+    }
+    std::vector<Message*> messages;
+    messages.reserve(batch.size());
+    for (size_t i = 0; i < batch.size(); ++i) {
+        auto const &key = batch[i]->key();
+        if (keyed_count == (size_t)newest.size() || key.isEmpty()
+            || newest[key] == i)
+            messages.push_back(batch[i].get());
+    }
+    if (messages.size() < batch.size())
+        metrics.coalesced(batch.size() - messages.size());
+
+    auto is_measured = metrics.isEnabled();
+    qint64 start = 0;
+    if (is_measured) {
+        start = nowNs();
+        for (auto m : messages)
+            metrics.dequeued(m->enqueued_, start);
+    }
+    auto handler = dynamic_cast<BatchHandler*>(obj);
+    if (handler) {
+        try {
+            handler->handleBatch(messages.data(), messages.size());
+        } catch (std::exception const &e) {
+            debug::warning("Actor batch handler exception:", e.what());
+        }
+    } else {
+        for (auto m : messages)
+            deliver(m, obj);
+    }
+    if (is_measured)
+        metrics.handled(messages.size(), nowNs() - start);
+}
+
 class Actor;
+class PoolActor;
+
+class ActorImpl;
+
+/**
+ * Reference to the actor used by timers and invokers. Unlike
+ * ActorHandle it does not own the actor, so the timer thread or the
+ * thread resolving a future never becomes the last owner destroying
+ * the actor. It is reset by the actor destructor.
+ */
+class ActorRef
+{
+public:
+    ActorRef(ActorImpl *impl) : impl_(impl) {}
+
+    ActorRef(ActorRef const&) = delete;
+    ActorRef& operator = (ActorRef const&) = delete;
+
+    /**
+     * Call fn(ActorImpl*) while the actor exists. Lock is recursive:
+     * rejected message can execute code posting to the same actor
+     *
+     * @return false if the actor is destroyed
+     */
+    template <typename FnT>
+    bool with(FnT fn)
+    {
+        std::lock_guard<std::recursive_mutex> l(mutex_);
+        if (!impl_)
+            return false;
+        fn(impl_);
+        return true;
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::recursive_mutex> l(mutex_);
+        impl_ = nullptr;
+    }
+
+private:
+    std::recursive_mutex mutex_;
+    ActorImpl *impl_;
+};
+
+/**
+ * Actor state executed by the global executor
+ */
+class PoolActor : public std::enable_shared_from_this<PoolActor>
+{
+public:
+    PoolActor()
+        : isActive_(true), isQuitRequested_(false), isQuitting_(false)
+        , isFinished_(false)
+    {}
+
+    void start(qobj_ctor_type, std::function<void()>);
+    /**
+     * Service messages are not limited by the mailbox capacity,
+     * messages posted w/o waiting are dropped if the mailbox is full
+     */
+    bool postMessage(std::unique_ptr<Message>, bool is_service = false
+                     , bool can_wait = true);
+    bool sendEvent(QEvent *);
+    void quit();
+    bool quitSync(unsigned long timeout);
+    bool isRunning() const { return isActive_; }
+
+    void setOnFinished(std::function<void()>);
+    void setRef(std::shared_ptr<ActorRef> ref) { ref_ = std::move(ref); }
+
+    Mailbox &mailbox() { return mailbox_; }
+    Dispatcher &dispatcher() { return dispatcher_; }
+
+    /// executed by a pool worker
+    void execute();
+
+private:
+    friend class StartMessage;
+    friend class QuitMessage;
+
+    void schedule(bool is_deferred);
+    void finish();
+
+    std::shared_ptr<QObject> obj_;
+    Mailbox mailbox_;
+    Dispatcher dispatcher_;
+    std::atomic<bool> isActive_;
+    // quit message is posted once
+    std::atomic<bool> isQuitRequested_;
+    bool isQuitting_;
+
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool isFinished_;
+    std::function<void()> onFinished_;
+    std::shared_ptr<ActorRef> ref_;
+};
+
+class StartMessage : public ServiceMessage
+{
+public:
+    StartMessage(PoolActor *actor, qobj_ctor_type ctor
+                 , std::function<void()> notify)
+        : actor_(actor), ctor_(std::move(ctor)), notify_(std::move(notify))
+    {}
+
+    void deliver(QObject *)
+    {
+        auto obj = ctor_();
+        // object is passed between pool workers. Without thread
+        // affinity it can be deleted directly by any thread instead of
+        // deleteLater() used by the original deleter
+        obj->moveToThread(nullptr);
+        actor_->obj_ = std::shared_ptr<QObject>(obj.release());
+        notify_();
+    }
+
+private:
+    PoolActor *actor_;
+    qobj_ctor_type ctor_;
+    std::function<void()> notify_;
+};
+
+class QuitMessage : public ServiceMessage
+{
+public:
+    QuitMessage(PoolActor *actor) : actor_(actor) {}
+
+    void deliver(QObject *)
+    {
+        actor_->isQuitting_ = true;
+    }
+
+private:
+    PoolActor *actor_;
+};
+
+static thread_local PoolActor *current_pool_actor_ = nullptr;
+// reference to the actor processing messages in this thread
+static thread_local std::shared_ptr<ActorRef> const *current_actor_ = nullptr;
+
+void PoolActor::start(qobj_ctor_type ctor, std::function<void()> notify)
+{
+    postMessage(std::unique_ptr<Message>
+                (new StartMessage(this, std::move(ctor), std::move(notify)))
+                , true);
+}
+
+bool PoolActor::postMessage(std::unique_ptr<Message> m, bool is_service
+                            , bool can_wait)
+{
+    if (!isActive_ || !m)
+        return false;
+    bool is_reserved = true;
+    if (is_service)
+        mailbox_.reserveForced();
+    else if (can_wait)
+        is_reserved = mailbox_.reserve(current_pool_actor_ != this);
+    else
+        is_reserved = mailbox_.reserveNoWait();
+    if (!is_reserved)
+        return false;
+    if (mailbox_.push(m.release()))
+        schedule(false);
+    return true;
+}
+
+bool PoolActor::sendEvent(QEvent *e)
+{
+    auto obj = obj_;
+    if (obj && isActive_) {
+        return QCoreApplication::sendEvent(obj.get(), e);
+    } else {
+        if (e) delete e;
+        return false;
+    }
+}
+
+void PoolActor::execute()
+{
+    // limit number of messages processed at once to be fair to other
+    // actors sharing the pool
+    static const size_t max_count = 64;
+
+    if (!isActive_) {
+        mailbox_.discard();
+        return;
+    }
+    current_pool_actor_ = this;
+    current_actor_ = &ref_;
+    auto count = dispatcher_.dispatch
+        (mailbox_, obj_.get(), max_count, isQuitting_);
+    current_actor_ = nullptr;
+    current_pool_actor_ = nullptr;
+    if (isQuitting_) {
+        finish();
+        return;
+    }
+    if (count >= max_count || mailbox_.rearm())
+        schedule(true);
+}
+
+void PoolActor::schedule(bool is_deferred)
+{
+    auto self = shared_from_this();
+    auto fn = [self]() { self->execute(); };
+    if (is_deferred)
+        Executor::global().defer(fn);
+    else
+        Executor::global().execute(fn);
+}
+
+void PoolActor::finish()
+{
+    isActive_ = false;
+    obj_.reset();
+    mailbox_.close();
+    mailbox_.discard();
+
+    std::function<void()> on_finished;
+    do {
+        std::lock_guard<std::mutex> l(mutex_);
+        on_finished = onFinished_;
+    } while (0);
+    if (on_finished)
+        on_finished();
+
+    std::lock_guard<std::mutex> l(mutex_);
+    isFinished_ = true;
+    cond_.notify_all();
+}
+
+void PoolActor::quit()
+{
+    if (isQuitRequested_.exchange(true))
+        return;
+    postMessage(std::unique_ptr<Message>(new QuitMessage(this)), true);
+}
+
+bool PoolActor::quitSync(unsigned long timeout)
+{
+    quit();
+    if (current_pool_actor_ == this)
+        return true;
+
+    std::unique_lock<std::mutex> l(mutex_);
+    if (!cond_.wait_for(l, std::chrono::milliseconds(timeout)
+                        , [this]() { return isFinished_; })) {
+        debug::warning("Timeout on sync quit");
+        return false;
+    }
+    return true;
+}
+
+void PoolActor::setOnFinished(std::function<void()> fn)
+{
+    std::lock_guard<std::mutex> l(mutex_);
+    onFinished_ = std::move(fn);
+}
 
 class ActorContext : public QObject
 {
@@ -29,6 +1031,139 @@ public:
     actor_callback_type notify_;
 };
 
+/// scheduling options applied by the actor thread to itself
+class ThreadOptions
+{
+public:
+    ThreadOptions()
+        : hasNice_(false), nice_(0), policy_(-1), ioprio_(-1)
+    {}
+
+    static bool isThreadOption(QString const &name)
+    {
+        static const QStringList names = {
+            "name", "cpus", "nice", "sched", "io_class", "io_priority"
+        };
+        return names.contains(name);
+    }
+
+    void configure(QVariantMap const &);
+    void apply() const;
+
+private:
+    QByteArray name_;
+    std::vector<int> cpus_;
+    bool hasNice_;
+    int nice_;
+    int policy_;
+    int ioprio_;
+};
+
+void ThreadOptions::configure(QVariantMap const &options)
+{
+    if (options.contains("name"))
+        name_ = options.value("name").toString().toUtf8().left(15);
+
+    if (options.contains("cpus")) {
+        auto v = options.value("cpus");
+        auto cpus = v.type() == QVariant::String
+            ? QVariant(v.toString().split(',')).toList() : v.toList();
+        for (auto const &cpu : cpus) {
+            bool ok = false;
+            auto i = cpu.toInt(&ok);
+            if (!ok || i < 0 || i >= CPU_SETSIZE)
+                error::raise({{"msg", "Wrong CPU index"}, {"cpu", cpu}});
+            cpus_.push_back(i);
+        }
+    }
+
+    if (options.contains("nice")) {
+        bool ok = false;
+        nice_ = options.value("nice").toInt(&ok);
+        if (!ok || nice_ < -20 || nice_ > 19)
+            error::raise({{"msg", "Wrong nice value"}
+                    , {"nice", options.value("nice")}});
+        hasNice_ = true;
+    }
+
+    if (options.contains("sched")) {
+        static const QMap<QString, int> policies = {
+            {"other", SCHED_OTHER}, {"batch", SCHED_BATCH}
+            , {"idle", SCHED_IDLE}
+        };
+        auto name = options.value("sched").toString();
+        auto it = policies.find(name);
+        if (it == policies.end())
+            error::raise({{"msg", "Unknown scheduling policy"}
+                    , {"sched", name}});
+        policy_ = it.value();
+    }
+
+    if (options.contains("io_class") || options.contains("io_priority")) {
+        // see linux/ioprio.h
+        enum { RealTime = 1, BestEffort = 2, Idle = 3, ClassShift = 13 };
+        static const QMap<QString, int> classes = {
+            {"realtime", RealTime}, {"best_effort", BestEffort}
+            , {"idle", Idle}
+        };
+        auto name = options.value("io_class", "best_effort").toString();
+        auto it = classes.find(name);
+        if (it == classes.end())
+            error::raise({{"msg", "Unknown I/O class"}, {"io_class", name}});
+        bool ok = false;
+        auto prio = options.value("io_priority", 4).toInt(&ok);
+        if (!ok || prio < 0 || prio > 7)
+            error::raise({{"msg", "Wrong I/O priority"}
+                    , {"io_priority", options.value("io_priority")}});
+        ioprio_ = (it.value() << ClassShift) | (it.value() == Idle ? 0 : prio);
+    }
+}
+
+void ThreadOptions::apply() const
+{
+    auto warn = [](char const *what) {
+        debug::warning("Can't set actor thread", what, ::strerror(errno));
+    };
+    auto self = pthread_self();
+    auto tid = (pid_t)::syscall(SYS_gettid);
+
+    if (!name_.isEmpty()) {
+        auto rc = pthread_setname_np(self, name_.constData());
+        if (rc) {
+            errno = rc;
+            warn("name");
+        }
+    }
+    if (!cpus_.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (auto cpu : cpus_)
+            CPU_SET(cpu, &set);
+        auto rc = pthread_setaffinity_np(self, sizeof(set), &set);
+        if (rc) {
+            errno = rc;
+            warn("affinity");
+        }
+    }
+    if (policy_ >= 0) {
+        sched_param param;
+        param.sched_priority = 0;
+        auto rc = pthread_setschedparam(self, policy_, &param);
+        if (rc) {
+            errno = rc;
+            warn("scheduling policy");
+        }
+    }
+    // on Linux nice value and I/O priority are per-thread
+    if (hasNice_ && ::setpriority(PRIO_PROCESS, tid, nice_) < 0)
+        warn("nice value");
+    if (ioprio_ >= 0) {
+        enum { WhoProcess = 1 };
+        if (::syscall(SYS_ioprio_set, WhoProcess, tid, ioprio_) < 0)
+            warn("I/O priority");
+    }
+}
+
 class ActorImpl : public QThread
 {
     Q_OBJECT
@@ -38,37 +1173,80 @@ protected:
     void run() Q_DECL_OVERRIDE;
 
 public:
-    ActorImpl(QObject *parent) : QThread(parent) {}
+    ActorImpl(QObject *parent)
+        : QThread(parent)
+        , isShutdownMissed_(false)
+        , ref_(std::make_shared<ActorRef>(this))
+        , eventFd_(-1)
+    {}
 
     ActorImpl(ActorImpl const&) = delete;
     ActorImpl& operator = (ActorImpl const&) = delete;
 
-    static void create(qobj_ctor_type, actor_callback_type, QObject *);
-    static ActorHandle createSync(qobj_ctor_type, QObject *parent);
+    static void create(qobj_ctor_type, actor_callback_type, QObject *
+                       , QVariantMap const &);
+    static ActorHandle createSync(qobj_ctor_type, QObject *parent
+                                  , QVariantMap const &);
 
     bool postEvent(QEvent *);
     bool sendEvent(QEvent *);
+    /// can_wait is false for posts from the timer thread
+    bool postMessage(std::unique_ptr<Message>, bool can_wait = true);
 
+    /// actor is running and accepts messages
+    bool isActive() const;
+
+    void requestQuit();
     bool quitSync(unsigned long timeout);
 
+    /**
+     * Leave running thread alone: it is deleted when finished instead
+     * of waiting for it in the destructor
+     */
+    void detach();
+
+    QVariantMap metrics() const;
+
+    /// actor missed application shutdown deadline, it is not waited
+    std::atomic<bool> isShutdownMissed_;
+    std::shared_ptr<ActorRef> ref_;
+
 private:
+    void wakeup();
+    void drain();
+
     std::shared_ptr<QObject> obj_;
+    Mailbox mailbox_;
+    Dispatcher dispatcher_;
+    int eventFd_;
+    std::shared_ptr<PoolActor> pool_;
+    ThreadOptions threadOptions_;
 };
 
+// total time to wait for actors on application shutdown
+static std::atomic<unsigned long> shutdown_timeout_(5000);
+
+void setShutdownTimeout(unsigned long msec)
+{
+    shutdown_timeout_ = msec;
+}
+
 Actor::Actor(QObject *parent)
     : QObject(parent), impl_(new ActorImpl(this))
 {
-    connect(impl_, &QThread::finished
-            , [this]() { this->finished(this); });
+    connect(impl_, &QThread::finished, this
+            , [this]() { this->finished(this); }, Qt::DirectConnection);
 }
 
 Actor::~Actor()
-{}
+{
+    if (impl_->isShutdownMissed_)
+        impl_->detach();
+}
 
 void Actor::quit()
 {
-    if (impl_->isRunning())
-        impl_->quit();
+    impl_->requestQuit();
 }
 
 bool Actor::quitSync(unsigned long timeout)
@@ -76,14 +1254,16 @@ bool Actor::quitSync(unsigned long timeout)
     return impl_->quitSync(timeout);
 }
 
-void Actor::create(qobj_ctor_type ctor, actor_callback_type cb, QObject *parent)
+void Actor::create(qobj_ctor_type ctor, actor_callback_type cb, QObject *parent
+                   , QVariantMap const &options)
 {
-    ActorImpl::create(ctor, cb, parent);
+    ActorImpl::create(ctor, cb, parent, options);
 }
 
-ActorHandle Actor::createSync(qobj_ctor_type ctor, QObject *parent)
+ActorHandle Actor::createSync(qobj_ctor_type ctor, QObject *parent
+                              , QVariantMap const &options)
 {
-    return ActorImpl::createSync(ctor, parent);
+    return ActorImpl::createSync(ctor, parent, options);
 }
 
 bool Actor::postEvent(QEvent *e)
@@ -96,33 +1276,118 @@ bool Actor::sendEvent(QEvent *e)
     return impl_->sendEvent(e);
 }
 
+bool Actor::postMessage(std::unique_ptr<Message> m)
+{
+    return impl_->postMessage(std::move(m));
+}
+
+QVariantMap Actor::metrics() const
+{
+    return impl_->metrics();
+}
+
+quint64 Actor::scheduleMessage(unsigned long msec, unsigned long period
+                               , std::function<void(QObject*)> fn)
+{
+    std::weak_ptr<ActorRef> weak_ref = impl_->ref_;
+    return TimerWheel::instance().add(msec, period, [weak_ref, fn]() {
+            // timer is stopped when actor is finished
+            auto ref = weak_ref.lock();
+            if (!ref)
+                return false;
+            // timer thread is shared, it is never blocked by the full
+            // mailbox: message is dropped and counted instead
+            typedef FnMessage<QObject, std::function<void(QObject*)> > msg_type;
+            bool is_kept = false;
+            ref->with([&is_kept, &fn](ActorImpl *impl) {
+                    is_kept = impl->postMessage
+                        (std::unique_ptr<Message>(new msg_type(fn)), false)
+                        || impl->isActive();
+                });
+            return is_kept;
+        });
+}
+
+bool Actor::cancelTimer(quint64 id)
+{
+    return TimerWheel::instance().cancel(id);
+}
+
 ActorImpl::~ActorImpl()
 {
+    ref_->reset();
     auto app = QCoreApplication::instance();
     if (app) {
-        quitSync(10000);
+        quitSync(isShutdownMissed_ ? 0 : shutdown_timeout_.load());
     }
+    if (pool_)
+        pool_->setOnFinished(nullptr);
     if (obj_ && this != QThread::currentThread())
         debug::warning("Managed object is not deleted in a right thread Current:"
                        , QThread::currentThread(), ", Need:", this);
+    if (eventFd_ >= 0)
+        ::close(eventFd_);
 }
 
 void ActorImpl::run()
 {
+    threadOptions_.apply();
     auto ctx = std::static_pointer_cast<ActorContext>(std::move(obj_));
     obj_ = ctx->ctor_();
+    std::unique_ptr<QSocketNotifier> notifier
+        (new QSocketNotifier(eventFd_, QSocketNotifier::Read));
+    connect(notifier.get(), &QSocketNotifier::activated
+            , [this]() { drain(); });
     ctx->notify_(std::move(ctx->actor_));
     exec();
+    mailbox_.close();
+    mailbox_.discard();
+    notifier.reset();
     obj_.reset();
 }
 
+void ActorImpl::wakeup()
+{
+    uint64_t v = 1;
+    while (::write(eventFd_, &v, sizeof(v)) < 0 && errno == EINTR) {}
+}
+
+void ActorImpl::drain()
+{
+    uint64_t v;
+    while (::read(eventFd_, &v, sizeof(v)) < 0 && errno == EINTR) {}
+    mailbox_.resetScheduled();
+    static const bool is_stopped = false;
+    current_actor_ = &ref_;
+    dispatcher_.dispatch(mailbox_, obj_.get()
+                         , std::numeric_limits<size_t>::max(), is_stopped);
+    current_actor_ = nullptr;
+}
+
+bool ActorImpl::postMessage(std::unique_ptr<Message> m, bool can_wait)
+{
+    if (pool_)
+        return pool_->postMessage(std::move(m), false, can_wait);
+
+    auto obj = obj_;
+    if (!obj || !m)
+        return false;
+    auto is_reserved = can_wait
+        ? mailbox_.reserve(QThread::currentThread() != this)
+        : mailbox_.reserveNoWait();
+    if (!is_reserved)
+        return false;
+    if (mailbox_.push(m.release()))
+        wakeup();
+    return true;
+}
+
 bool ActorImpl::postEvent(QEvent *e)
 {
     auto obj = obj_;
 
-    if (obj) {
-        QCoreApplication::postEvent(obj.get(), e);
-        return true;
+    if ((obj || pool_) && e) {
+        return postMessage(std::unique_ptr<Message>(new EventMessage(e)));
     } else {
         if (e) delete e;
         return false;
@@ -131,6 +1396,9 @@ bool ActorImpl::postEvent(QEvent *e)
 
 bool ActorImpl::sendEvent(QEvent *e)
 {
+    if (pool_)
+        return pool_->sendEvent(e);
+
     auto obj = obj_;
     if (obj) {
         return QCoreApplication::sendEvent(obj.get(), e);
@@ -140,8 +1408,48 @@ bool ActorImpl::sendEvent(QEvent *e)
     }
 }
 
+bool ActorImpl::isActive() const
+{
+    if (pool_)
+        return pool_->isRunning();
+    auto obj = obj_;
+    return obj && !mailbox_.isClosed();
+}
+
+QVariantMap ActorImpl::metrics() const
+{
+    auto const &mailbox = pool_ ? pool_->mailbox() : mailbox_;
+    return mailbox.metrics().toMap(mailbox.size());
+}
+
+void ActorImpl::detach()
+{
+    if (pool_)
+        return;
+    // thread can finish in between, so connect before checking
+    auto c = connect(this, &QThread::finished, this, &QObject::deleteLater);
+    if (!isRunning()) {
+        // queued deletion (if any) is dropped with the object deleted
+        // by the parent
+        disconnect(c);
+        return;
+    }
+    setParent(nullptr);
+}
+
+void ActorImpl::requestQuit()
+{
+    if (pool_)
+        pool_->quit();
+    else if (isRunning())
+        quit();
+}
+
 bool ActorImpl::quitSync(unsigned long timeout)
 {
+    if (pool_)
+        return !pool_->isRunning() || pool_->quitSync(timeout);
+
     if (!isRunning())
         return true;
 
@@ -155,17 +1463,61 @@ bool ActorImpl::quitSync(unsigned long timeout)
 }
 
 void ActorImpl::create(qobj_ctor_type ctor, actor_callback_type cb
-                       , QObject *parent)
+                       , QObject *parent, QVariantMap const &options)
 {
+    auto is_pool = options.value("pool").toBool();
+    for (auto it = options.begin(); it != options.end(); ++it) {
+        if (is_pool && ThreadOptions::isThreadOption(it.key()))
+            error::raise({{"msg", "Option is not supported by pooled actor"}
+                    , {"option", it.key()}});
+    }
+    ThreadOptions thread_options;
+    thread_options.configure(options);
+
     auto wrapper = make_qobject_shared<Actor>(parent);
     auto self = wrapper->impl_;
+    auto actor = wrapper.get();
+    if (options.contains("metrics_dump")) {
+        auto timer = new QTimer(actor);
+        timer->setInterval(options.value("metrics_dump").toInt());
+        connect(timer, &QTimer::timeout, [actor]() {
+                debug::info("Actor", actor, "metrics:", actor->metrics());
+            });
+        connect(actor, &Actor::finished, timer, &QTimer::stop);
+        timer->start();
+    }
+    auto on_water = [actor](bool is_high) {
+        if (is_high)
+            emit actor->highWater(actor);
+        else
+            emit actor->lowWater(actor);
+    };
+    if (is_pool) {
+        self->pool_ = std::make_shared<PoolActor>();
+        self->pool_->mailbox().configure(options, on_water);
+        self->pool_->dispatcher().configure(options);
+        self->pool_->setRef(self->ref_);
+        self->pool_->setOnFinished([actor]() { emit actor->finished(actor); });
+        self->pool_->start(std::move(ctor), [wrapper, cb]() mutable {
+                cb(std::move(wrapper));
+            });
+        return;
+    }
+    self->mailbox_.configure(options, on_water);
+    self->dispatcher_.configure(options);
+    self->threadOptions_ = thread_options;
+    self->eventFd_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (self->eventFd_ < 0)
+        error::raise({{"msg", "Can't create actor eventfd"}
+                , {"error", ::strerror(errno)}});
     auto ctx = make_qobject_unique<ActorContext>
         (wrapper, std::move(ctor), std::move(cb));
     self->obj_ = qobject_shared_cast(std::move(ctx));
     self->start();
 }
 
-ActorHandle ActorImpl::createSync(qobj_ctor_type ctor, QObject *parent)
+ActorHandle ActorImpl::createSync(qobj_ctor_type ctor, QObject *parent
+                                  , QVariantMap const &options)
 {
     std::mutex mutex;
     std::condition_variable cond;
@@ -175,11 +1527,134 @@ ActorHandle ActorImpl::createSync(qobj_ctor_type ctor, QObject *parent)
             std::unique_lock<std::mutex> l(mutex);
             result = p;
             cond.notify_all();
-        }, parent);
+        }, parent, options);
     cond.wait(l, [&result]() { return !!result; });
     return result;
 }
 
+ActorGroup::ActorGroup(qobj_ctor_type ctor, QVariantMap const &options)
+    : hotFactor_(options.value("hot_factor", 2.0).toDouble())
+{
+    auto size = options.value("size").toInt();
+    if (size <= 0)
+        size = std::max(1, QThread::idealThreadCount());
+    auto actor_options = options;
+    actor_options.remove("size");
+    actor_options.remove("hot_factor");
+    counts_.reset(new std::atomic<quint64>[size]);
+    auto name = options.value("name").toString();
+    for (int i = 0; i < size; ++i) {
+        counts_[i] = 0;
+        if (!name.isEmpty())
+            actor_options["name"] = QString("%1-%2").arg(name).arg(i);
+        actors_.push_back(Actor::createSync(ctor, nullptr, actor_options));
+    }
+}
+
+ActorGroup::~ActorGroup()
+{
+    quit();
+}
+
+size_t ActorGroup::shardIndex(QString const &key) const
+{
+    return qHash(key, 0) % actors_.size();
+}
+
+ActorHandle const &ActorGroup::route(QString const &key)
+{
+    auto index = shardIndex(key);
+    ++counts_[index];
+    return actors_[index];
+}
+
+std::vector<size_t> ActorGroup::hotShards() const
+{
+    std::vector<size_t> res;
+    quint64 total = 0;
+    for (size_t i = 0; i < actors_.size(); ++i)
+        total += counts_[i];
+    if (!total)
+        return res;
+    auto limit = hotFactor_ * total / actors_.size();
+    for (size_t i = 0; i < actors_.size(); ++i) {
+        if (counts_[i] > limit)
+            res.push_back(i);
+    }
+    return res;
+}
+
+QVariantMap ActorGroup::stats() const
+{
+    QVariantList shards, hot;
+    for (size_t i = 0; i < actors_.size(); ++i) {
+        auto metrics = actors_[i]->metrics();
+        shards.push_back(QVariantMap{{"messages", (quint64)counts_[i]}
+                , {"depth", metrics["depth"]}});
+    }
+    for (auto i : hotShards())
+        hot.push_back((quint64)i);
+    return {{"shards", shards}, {"hot", hot}};
+}
+
+void ActorGroup::resetStats()
+{
+    for (size_t i = 0; i < actors_.size(); ++i)
+        counts_[i] = 0;
+}
+
+void ActorGroup::quit()
+{
+    for (auto &actor : actors_)
+        actor->quit();
+}
+
+bool ActorGroup::quitSync(unsigned long timeout)
+{
+    quit();
+    QElapsedTimer timer;
+    timer.start();
+    auto res = true;
+    for (auto &actor : actors_) {
+        auto elapsed = (unsigned long)timer.elapsed();
+        auto left = elapsed < timeout ? timeout - elapsed : 0;
+        res = actor->quitSync(left) && res;
+    }
+    return res;
+}
+
+invoker_type currentInvoker(bool can_run_inline)
+{
+    if (current_actor_) {
+        auto ref = *current_actor_;
+        return [ref](std::function<void()> fn) {
+            typedef FnMessage<QObject, std::function<void(QObject*)> > msg_type;
+            std::function<void(QObject*)> deliver = [fn](QObject *) { fn(); };
+            ref->with([&deliver](ActorImpl *impl) {
+                    impl->postMessage(std::unique_ptr<Message>
+                                      (new msg_type(std::move(deliver))));
+                });
+        };
+    }
+    auto app = QCoreApplication::instance();
+    if (app && app->thread() == QThread::currentThread())
+        return [app](std::function<void()> fn) { invokeLater(app, fn); };
+    if (!can_run_inline)
+        return invoker_type();
+    return [](std::function<void()> fn) { fn(); };
+}
+
+Future<void> after(unsigned long msec)
+{
+    Promise<void> p;
+    auto id = TimerWheel::instance().add(msec, 0, [p]() {
+            p.setValue();
+            return false;
+        });
+    p.onCancel([id]() { TimerWheel::instance().cancel(id); });
+    return p.future();
+}
+
 class AppExitMonitor : public QObject
 {
     Q_OBJECT
@@ -228,10 +1703,32 @@ void AppExitMonitor::actorFinished(Actor *p)
 
 void AppExitMonitor::beforeAppQuit()
 {
+    std::vector<ActorHandle> actors;
     for (auto &kv : actors_) {
         auto actor = kv.second.lock();
         if (actor)
-            actor->quitSync(10000); // random timeout
+            actors.push_back(actor);
+    }
+    // all actors are quitting in parallel, waiting under the single
+    // deadline
+    for (auto &actor : actors)
+        actor->quit();
+
+    unsigned long timeout = shutdown_timeout_;
+    QElapsedTimer timer;
+    timer.start();
+    QList<Actor*> missed;
+    for (auto &actor : actors) {
+        auto elapsed = (unsigned long)timer.elapsed();
+        auto left = elapsed < timeout ? timeout - elapsed : 0;
+        if (!actor->quitSync(left)) {
+            actor->impl_->isShutdownMissed_ = true;
+            missed.push_back(actor.get());
+        }
+    }
+    if (!missed.isEmpty()) {
+        debug::warning("Actors missed shutdown deadline of", timeout
+                       , "ms:", missed);
     }
 }
 
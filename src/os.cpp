@@ -8,6 +8,7 @@
 
 #include <qtaround/os.hpp>
 #include <qtaround/util.hpp>
+#include <qtaround/range.hpp>
 #include <qtaround/debug.hpp>
 #include <QDebug>
 
@@ -111,10 +112,14 @@ QString target(QString const &link)
 
 int system(QString const &cmd, QStringList const &args)
 {
-    Process p;
-    p.start(cmd, args);
-    p.wait(-1);
-    return p.rc();
+    return subprocess::call(cmd, args);
+}
+
+mt::Future<int> system_async(QString const &cmd, QStringList const &args
+                             , QVariantMap const &options)
+{
+    return subprocess::run_async(cmd, args, options).then
+        ([](mt::Future<subprocess::Result> f) { return f.get().rc; });
 }
 
 bool mkdir(QString const &path, QVariantMap const &options)
@@ -206,26 +211,21 @@ size_t get_block_size(QString const &cmd_name)
 
 QList<QVariantMap> mount()
 {
-    auto line2obj = [](QString const &line) {
-        static const QStringList names = {"src", "dst", "type", "options"};
-        auto fields = line.split(QRegExp("\\s+"));
-        return map(util::zip(names, fields));
+    static const QStringList names = {"src", "dst", "type", "options"};
+    auto name_value = [](std::tuple<QString, QString> const &nv) {
+        auto const &name = std::get<0>(nv);
+        auto const &value = std::get<1>(nv);
+        return std::make_tuple
+            (name, name != "options" ? QVariant(value) : QVariant(value.split(",")));
     };
-    auto split_options = [](QMap<QString, QString> const &fields) {
-        QVariantMap res;
-        for (auto it = fields.begin(); it != fields.end(); ++it) {
-            if (it.key() != "options")
-                res.insert(it.key(), it.value());
-            else
-                res.insert(it.key(), it.value().split(","));
-        }
-        return res;
+    auto line2obj = [name_value](QString const &line) {
+        auto fields = util::from(line.split(QRegExp("\\s+")));
+        return util::zip(util::from(names), fields).map(name_value).toMap();
     };
 
     auto data = str(subprocess::check_output("cat", {"/proc/mounts"}));
-    auto lines = filterEmpty(data.split("\n"));
-    auto fields = util::map<QMap<QString, QString> >(line2obj, lines);
-    return util::map<QVariantMap>(split_options, fields);
+    return util::split(data, '\n', QString::SkipEmptyParts)
+        .map(line2obj).toList();
 }
 
 QString mountpoint(QString const &path)
@@ -236,7 +236,7 @@ QString mountpoint(QString const &path)
     QStringList commands = {"df -P " + singleQuoted(path)
                             , "tail -1", "awk '{ print $NF; }'"};
     QStringList options = {"-c", commands.join(" | ")};
-    auto data = subprocess::check_output("sh", options);
+    auto data = subprocess::Cache::instance().check_output("sh", options);
     auto res = str(data).split("\n")[0];
     debug::info("Mountpoint for", path, "=", res);
     return res;
@@ -245,6 +245,8 @@ QString mountpoint(QString const &path)
 /**
  * options.fields - sequence of characters used for field ids used by
  * stat (man 1 stat)
+ * options.cache - memoize result in subprocess::Cache, use only for
+ * fields not changing over time (e.g. mount point)
  */
 string_map_type stat(QString const &path, QVariantMap &&options)
 {
@@ -264,10 +266,14 @@ string_map_type stat(QString const &path, QVariantMap &&options)
     };
     options["format"] = commify(requested);
 
+    auto is_cached = is(options.take("cache"));
     auto cmd_options = sys::command_line_options(options, {}, long_options, {"format"});
     cmd_options.push_back(path);
 
-    auto data = str(subprocess::check_output("stat", cmd_options)).trimmed().split(",");
+    auto data = str(is_cached
+                    ? subprocess::Cache::instance().check_output("stat", cmd_options)
+                    : subprocess::check_output("stat", cmd_options))
+        .trimmed().split(",");
     if (data.size() != requested.size())
         error::raise({{"msg", "Fields set length != stat result length"}
                 , {"fields", options["fields"]}
@@ -313,20 +319,17 @@ public:
         if (!isOk)
             return QVariantMap{};
 
-        auto split_colon = [](QString const &l) { return l.split(":"); };
-        auto name_fields = util::map<QStringList>(split_colon, data);
-
-        auto parse = [](QStringList const &nf) {
-            auto parse_size = [](QString const &n_eq_v) {
-                auto nv = n_eq_v.trimmed().split("=");
-                auto kb = util::parseBytes(nv[1], "kb", kb_bytes);
-                return std::make_tuple(nv[0], kb);
-            };
-            auto names_kbs = util::map<map_tuple_type>(parse_size, nf[1].split(","));
-            auto fields = map(names_kbs);
-            return std::make_tuple(nf[0], QVariant(fields));
+        auto parse_size = [](QString const &n_eq_v) {
+            auto nv = n_eq_v.trimmed().split("=");
+            auto kb = util::parseBytes(nv[1], "kb", kb_bytes);
+            return map_tuple_type(nv[0], kb);
+        };
+        auto parse = [parse_size](QString const &line) {
+            auto nf = line.split(":");
+            auto fields = util::split(nf[1], ',').map(parse_size).toMap();
+            return map_tuple_type(nf[0], fields);
         };
-        return map(util::map<map_tuple_type>(parse, name_fields));
+        return util::from(data).map(parse).toMap();
     }
 
     double free()
@@ -340,14 +343,11 @@ public:
         // no btrfs exec
         if (info.isEmpty()) return total;
 
-        auto used = util::map<double>([](QString const &, QVariant const &v) {
-                auto get_used = [](QString const &k, QVariant const &v) {
-                    return (k == "used") ? v.toDouble() : 0.0;
-                };
-                auto used = util::map<double>(get_used, v.toMap());
-                return std::accumulate(used.begin(), used.end(), 0.0);
-            }, info);
-        return total - std::accumulate(used.begin(), used.end(), 0.0);
+        auto get_used = [](QVariant const &v) {
+            return v.toMap().value("used").toDouble();
+        };
+        auto sum = [](double acc, double v) { return acc + v; };
+        return total - util::from(info).map(get_used).reduce(0.0, sum);
     }
 
 private:
@@ -372,7 +372,7 @@ private:
 double diskFree(QString const &path)
 {
     debug::debug("diskFree for", path);
-    auto s = stat(path, {{"fields", "m"}});
+    auto s = stat(path, {{"fields", "m"}, {"cache", true}});
     auto mount_point = s["mount_point"];
     if (mount_point == "?")
         mount_point = mountpoint(path);
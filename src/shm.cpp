@@ -0,0 +1,520 @@
+/**
+ * @file shm.cpp
+ * @brief Shared memory transport between processes
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <qtaround/shm.hpp>
+#include <qtaround/debug.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <new>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS 1033
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#endif
+
+namespace qtaround { namespace shm {
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2
+              , "Shared memory atomics should be lock-free");
+
+namespace {
+
+typedef std::chrono::steady_clock clock_type;
+
+enum {
+    CacheLine = 64
+    , RecordAlign = 8
+    , HeaderSize = 4096
+};
+
+/// message length marking the rest of the ring as unused
+static const quint32 wrap_marker = 0xffffffff;
+
+/// placed at the beginning of the shared memory
+struct RingHeader
+{
+    enum { Magic = 0x51545352, Version = 1 };
+
+    quint32 magic;
+    quint32 version;
+    quint64 capacity;
+    // written by the writer
+    alignas(CacheLine) std::atomic<quint64> head;
+    std::atomic<quint32> isWriterWaiting;
+    // written by the reader
+    alignas(CacheLine) std::atomic<quint64> tail;
+    std::atomic<quint32> isReaderWaiting;
+    alignas(CacheLine) std::atomic<quint32> isClosed;
+};
+
+static_assert(sizeof(RingHeader) <= HeaderSize, "Ring header is too large");
+
+inline size_t recordSize(size_t len)
+{
+    return (sizeof(quint32) + len + RecordAlign - 1) & ~(size_t)(RecordAlign - 1);
+}
+
+int dupFd(int fd)
+{
+    auto res = ::fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (res < 0)
+        error::raise({{"msg", "Can't duplicate descriptor"}, {"fd", fd}
+                , {"error", ::strerror(errno)}});
+    return res;
+}
+
+}
+
+class RingImpl
+{
+public:
+    /// capacity is validated by the caller, it is not re-read from
+    /// the memory shared with the peer
+    RingImpl(RingFds const &fds, void *mem, size_t size, size_t capacity)
+        : fds_(fds)
+        , mem_(mem)
+        , size_(size)
+        , header_(static_cast<RingHeader*>(mem))
+        , data_(static_cast<char*>(mem) + HeaderSize)
+        , mask_(capacity - 1)
+    {}
+
+    ~RingImpl()
+    {
+        ::munmap(mem_, size_);
+        for (auto fd : {fds_.memory, fds_.data, fds_.space})
+            ::close(fd);
+    }
+
+    bool write(char const *data, size_t len, long msec);
+    bool read(QByteArray &, long msec);
+    void close();
+
+    bool isClosed() const
+    {
+        return header_->isClosed.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask_ + 1; }
+    size_t maxMessageSize() const { return capacity() / 2 - sizeof(quint32); }
+
+    RingFds fds_;
+
+private:
+    static void signal(int fd);
+    static bool wait(int fd, clock_type::time_point const &deadline, long msec);
+
+    void *mem_;
+    size_t size_;
+    RingHeader *header_;
+    char *data_;
+    size_t mask_;
+    std::mutex writeMutex_;
+    std::mutex readMutex_;
+};
+
+void RingImpl::signal(int fd)
+{
+    uint64_t v = 1;
+    while (::write(fd, &v, sizeof(v)) < 0 && errno == EINTR) {}
+}
+
+bool RingImpl::wait(int fd, clock_type::time_point const &deadline, long msec)
+{
+    int timeout = -1;
+    if (msec >= 0) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>
+            (deadline - clock_type::now()).count();
+        if (left <= 0)
+            return false;
+        timeout = (int)left;
+    }
+    pollfd pfd{fd, POLLIN, 0};
+    while (::poll(&pfd, 1, timeout) < 0 && errno == EINTR) {}
+    uint64_t v;
+    while (::read(fd, &v, sizeof(v)) < 0 && errno == EINTR) {}
+    return true;
+}
+
+bool RingImpl::write(char const *data, size_t len, long msec)
+{
+    if (len > maxMessageSize())
+        error::raise({{"msg", "Message is too large"}, {"size", (quint64)len}
+                , {"max", (quint64)maxMessageSize()}});
+
+    std::lock_guard<std::mutex> l(writeMutex_);
+    auto deadline = clock_type::now() + std::chrono::milliseconds(msec);
+    auto rec_size = recordSize(len);
+    auto head = header_->head.load(std::memory_order_relaxed);
+    size_t offset, skip, needed;
+    auto has_space = [&]() {
+        auto tail = header_->tail.load(std::memory_order_acquire);
+        return capacity() - (head - tail) >= needed;
+    };
+    while (true) {
+        offset = head & mask_;
+        skip = offset + rec_size > capacity() ? capacity() - offset : 0;
+        needed = skip + rec_size;
+        if (isClosed())
+            return false;
+        if (has_space())
+            break;
+        if (!msec)
+            return false;
+        header_->isWriterWaiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto is_timeout = !has_space() && !isClosed()
+            && !wait(fds_.space, deadline, msec);
+        header_->isWriterWaiting.store(0, std::memory_order_relaxed);
+        if (is_timeout)
+            return false;
+    }
+
+    if (skip) {
+        *reinterpret_cast<quint32*>(data_ + offset) = wrap_marker;
+        head += skip;
+        offset = 0;
+    }
+    *reinterpret_cast<quint32*>(data_ + offset) = (quint32)len;
+    memcpy(data_ + offset + sizeof(quint32), data, len);
+    header_->head.store(head + rec_size, std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->isReaderWaiting.load(std::memory_order_relaxed))
+        signal(fds_.data);
+    return true;
+}
+
+bool RingImpl::read(QByteArray &res, long msec)
+{
+    std::lock_guard<std::mutex> l(readMutex_);
+    auto deadline = clock_type::now() + std::chrono::milliseconds(msec);
+    auto tail = header_->tail.load(std::memory_order_relaxed);
+    quint64 head;
+    auto has_data = [&]() {
+        head = header_->head.load(std::memory_order_acquire);
+        return head != tail;
+    };
+    while (!has_data()) {
+        // data written before closing is still read
+        if (isClosed()) {
+            if (has_data())
+                break;
+            return false;
+        }
+        if (!msec)
+            return false;
+        header_->isReaderWaiting.store(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        auto is_timeout = !has_data() && !isClosed()
+            && !wait(fds_.data, deadline, msec);
+        header_->isReaderWaiting.store(0, std::memory_order_relaxed);
+        if (is_timeout)
+            return false;
+    }
+
+    // memory is shared with the peer, so nothing read from it is
+    // trusted before copying
+    auto corrupted = [&](char const *what) {
+        error::raise({{"msg", "Ring is corrupted"}, {"reason", what}
+                , {"head", head}, {"tail", tail}});
+    };
+    auto available = head - tail;
+    if (available > capacity())
+        corrupted("head");
+    auto offset = tail & mask_;
+    if (offset + sizeof(quint32) > capacity())
+        corrupted("offset");
+    auto len = *reinterpret_cast<quint32 const*>(data_ + offset);
+    if (len == wrap_marker) {
+        auto skip = capacity() - offset;
+        if (skip >= available)
+            corrupted("wrap marker");
+        tail += skip;
+        available -= skip;
+        offset = 0;
+        len = *reinterpret_cast<quint32 const*>(data_ + offset);
+    }
+    if (len > maxMessageSize()
+        || offset + sizeof(quint32) + len > capacity()
+        || recordSize(len) > available)
+        corrupted("size");
+    res = QByteArray(data_ + offset + sizeof(quint32), len);
+    header_->tail.store(tail + recordSize(len), std::memory_order_release);
+
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (header_->isWriterWaiting.load(std::memory_order_relaxed))
+        signal(fds_.space);
+    return true;
+}
+
+void RingImpl::close()
+{
+    header_->isClosed.store(1, std::memory_order_release);
+    signal(fds_.data);
+    signal(fds_.space);
+}
+
+Ring::Ring(std::unique_ptr<RingImpl> impl)
+    : impl_(std::move(impl))
+{}
+
+Ring::~Ring()
+{
+}
+
+std::shared_ptr<Ring> Ring::create(size_t capacity)
+{
+    size_t size = HeaderSize;
+    while (size < capacity)
+        size <<= 1;
+    capacity = size;
+    size += HeaderSize;
+
+    RingFds fds{-1, -1, -1};
+    auto cleanup = [&fds](char const *what) {
+        auto err = errno;
+        for (auto fd : {fds.memory, fds.data, fds.space})
+            if (fd >= 0)
+                ::close(fd);
+        error::raise({{"msg", "Can't create shared memory ring"}
+                , {"op", what}, {"error", ::strerror(err)}});
+    };
+    fds.memory = (int)::syscall(SYS_memfd_create, "qtaround-ring"
+                                , MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fds.memory < 0)
+        cleanup("memfd_create");
+    if (::ftruncate(fds.memory, size) < 0)
+        cleanup("ftruncate");
+    // peer should not be able to truncate memory under our feet
+    if (::fcntl(fds.memory, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0)
+        cleanup("fcntl");
+    fds.data = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fds.data < 0)
+        cleanup("eventfd");
+    fds.space = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fds.space < 0)
+        cleanup("eventfd");
+    auto mem = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED
+                      , fds.memory, 0);
+    if (mem == MAP_FAILED)
+        cleanup("mmap");
+
+    auto header = new (mem) RingHeader();
+    header->magic = RingHeader::Magic;
+    header->version = RingHeader::Version;
+    header->capacity = capacity;
+    header->head = 0;
+    header->tail = 0;
+    header->isWriterWaiting = 0;
+    header->isReaderWaiting = 0;
+    header->isClosed = 0;
+    std::unique_ptr<RingImpl> impl(new RingImpl(fds, mem, size, capacity));
+    return std::shared_ptr<Ring>(new Ring(std::move(impl)));
+}
+
+std::shared_ptr<Ring> Ring::attach(RingFds const &from)
+{
+    struct stat st;
+    if (::fstat(from.memory, &st) < 0 || (size_t)st.st_size <= HeaderSize)
+        error::raise({{"msg", "Wrong shared memory descriptor"}
+                , {"fd", from.memory}});
+    size_t size = st.st_size;
+    auto mem = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED
+                      , from.memory, 0);
+    if (mem == MAP_FAILED)
+        error::raise({{"msg", "Can't map shared memory"}
+                , {"error", ::strerror(errno)}});
+    auto header = static_cast<RingHeader*>(mem);
+    size_t capacity = header->capacity;
+    auto seals = ::fcntl(from.memory, F_GET_SEALS);
+    if (seals < 0 || !(seals & F_SEAL_SHRINK)
+        || header->magic != RingHeader::Magic
+        || header->version != RingHeader::Version
+        || capacity + HeaderSize != size || (capacity & (capacity - 1))) {
+        ::munmap(mem, size);
+        error::raise({{"msg", "Not a ring buffer"}, {"fd", from.memory}});
+    }
+    RingFds fds{-1, -1, -1};
+    try {
+        fds.memory = dupFd(from.memory);
+        fds.data = dupFd(from.data);
+        fds.space = dupFd(from.space);
+    } catch (...) {
+        ::munmap(mem, size);
+        for (auto fd : {fds.memory, fds.data, fds.space})
+            if (fd >= 0)
+                ::close(fd);
+        throw;
+    }
+    std::unique_ptr<RingImpl> impl(new RingImpl(fds, mem, size, capacity));
+    return std::shared_ptr<Ring>(new Ring(std::move(impl)));
+}
+
+RingFds Ring::fds() const
+{
+    return impl_->fds_;
+}
+
+size_t Ring::capacity() const
+{
+    return impl_->capacity();
+}
+
+size_t Ring::maxMessageSize() const
+{
+    return impl_->maxMessageSize();
+}
+
+bool Ring::write(char const *data, size_t len, long msec)
+{
+    return impl_->write(data, len, msec);
+}
+
+bool Ring::read(QByteArray &data, long msec)
+{
+    return impl_->read(data, msec);
+}
+
+void Ring::close()
+{
+    impl_->close();
+}
+
+bool Ring::isClosed() const
+{
+    return impl_->isClosed();
+}
+
+bool RemoteActor::post(QString const &key, QByteArray const &data, long msec)
+{
+    // message: key length, key, data
+    auto k = key.toUtf8();
+    quint32 key_len = k.size();
+    std::lock_guard<std::mutex> l(mutex_);
+    buffer_.resize(0);
+    buffer_.reserve(sizeof(key_len) + k.size() + data.size());
+    buffer_.append(reinterpret_cast<char const*>(&key_len), sizeof(key_len));
+    buffer_.append(k);
+    buffer_.append(data);
+    return ring_->write(buffer_, msec);
+}
+
+namespace {
+
+class RemoteMessage : public mt::Message
+{
+public:
+    RemoteMessage(std::shared_ptr<ActorEndpoint::handler_type> const &handler
+                  , QString const &key, QByteArray &&data)
+        : handler_(handler), data_(std::move(data))
+    {
+        setKey(key);
+    }
+
+    void deliver(QObject *obj)
+    {
+        (*handler_)(obj, data_);
+    }
+
+private:
+    std::shared_ptr<ActorEndpoint::handler_type> handler_;
+    QByteArray data_;
+};
+
+}
+
+ActorEndpoint::ActorEndpoint(std::shared_ptr<Ring> const &ring
+                             , mt::ActorHandle const &actor)
+    : ring_(ring), actor_(actor)
+{}
+
+ActorEndpoint::~ActorEndpoint()
+{
+    ring_->close();
+    wait();
+}
+
+void ActorEndpoint::setHandler(QString const &key, handler_type fn)
+{
+    if (thread_.joinable())
+        error::raise({{"msg", "Endpoint is already started"}, {"key", key}});
+    handlers_[key] = std::make_shared<handler_type>(std::move(fn));
+}
+
+void ActorEndpoint::start()
+{
+    if (thread_.joinable())
+        error::raise({{"msg", "Endpoint is already started"}});
+    thread_ = std::thread([this]() { run(); });
+}
+
+void ActorEndpoint::wait()
+{
+    if (thread_.joinable())
+        thread_.join();
+}
+
+void ActorEndpoint::run()
+{
+    QByteArray data;
+    while (true) {
+        // ring is written by the peer, its corruption should not
+        // terminate the process
+        try {
+            if (!ring_->read(data))
+                break;
+        } catch (error::Error const &e) {
+            debug::warning("Remote actor: closing ring:", e.what());
+            ring_->close();
+            break;
+        }
+        quint32 key_len;
+        if ((size_t)data.size() < sizeof(key_len)) {
+            debug::warning("Remote actor: wrong message size", data.size());
+            continue;
+        }
+        memcpy(&key_len, data.constData(), sizeof(key_len));
+        if (data.size() - sizeof(key_len) < key_len) {
+            debug::warning("Remote actor: wrong key size", key_len);
+            continue;
+        }
+        auto key = QString::fromUtf8(data.constData() + sizeof(key_len), key_len);
+        auto it = handlers_.find(key);
+        if (it == handlers_.end()) {
+            debug::warning("Remote actor: no handler for", key);
+            continue;
+        }
+        data.remove(0, sizeof(key_len) + key_len);
+        std::unique_ptr<mt::Message> m
+            (new RemoteMessage(it.value(), key, std::move(data)));
+        data = QByteArray();
+        if (!actor_->postMessage(std::move(m))) {
+            debug::warning("Remote actor: actor is not running, dropping", key);
+            continue;
+        }
+    }
+}
+
+}}
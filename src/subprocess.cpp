@@ -10,9 +10,99 @@
 #include <qtaround/error.hpp>
 #include <qtaround/debug.hpp>
 #include <qtaround/util.hpp>
+#include <qtaround/os.hpp>
+#include "forkserver.hpp"
+
+#include <QDir>
+#include <QUuid>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QSocketNotifier>
+
+#include <QHash>
+
+#include <mutex>
+#include <chrono>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+
+extern char **environ;
 
 namespace qtaround { namespace subprocess {
 
+namespace {
+
+class ChildProcess : public QProcess
+{
+public:
+    ChildProcess()
+    {
+        std::fill(fds_, fds_ + 3, -1);
+    }
+
+    int fds_[3];
+
+protected:
+    void setupChildProcess() Q_DECL_OVERRIDE
+    {
+        // executed in the child after QProcess has set up channels
+        for (int i = 0; i < 3; ++i)
+            if (fds_[i] >= 0)
+                ::dup2(fds_[i], i);
+    }
+};
+
+}
+
+Process::Process()
+    : ps(new ChildProcess())
+    , isRunning_(false)
+    , isError_(false)
+{}
+
+void Process::setStdin(int fd)
+{
+    static_cast<ChildProcess*>(ps.get())->fds_[0] = fd;
+}
+
+void Process::setStdout(int fd)
+{
+    static_cast<ChildProcess*>(ps.get())->fds_[1] = fd;
+}
+
+void Process::setStderr(int fd)
+{
+    static_cast<ChildProcess*>(ps.get())->fds_[2] = fd;
+}
+
+qint64 Process::write(QIODevice &src)
+{
+    static const qint64 chunk_size = 64 * 1024;
+    QByteArray buf;
+    qint64 res = 0;
+    while (true) {
+        buf.resize(chunk_size);
+        auto len = src.read(buf.data(), chunk_size);
+        if (len <= 0 && !src.waitForReadyRead(-1))
+            break;
+        if (len <= 0)
+            continue;
+        buf.resize(len);
+        auto written = ps->write(buf);
+        if (written < 0)
+            return written;
+        res += written;
+        // do not accumulate the whole source in the write buffer
+        while (ps->bytesToWrite() > chunk_size)
+            if (!ps->waitForBytesWritten(-1))
+                return res;
+    }
+    return res;
+}
+
 void Process::start(QString const &cmd, QStringList const &args)
 {
     if (isRunning_)
@@ -86,22 +176,41 @@ bool Process::is_error() const
             : true);
 }
 
-void Process::check_error(QVariantMap const &error_info)
+namespace {
+
+void checkResult(QString const &cmd, QStringList const &args
+                 , Result const &res, QString const &pwd
+                 , QVariantMap const &error_info)
 {
-    if (!rc())
+    if (!res.rc)
         return;
     QVariantMap err = {{"msg", "Process error"}
-                       , {"cmd", ps->program()}
-                       , {"args", QVariant(ps->arguments())}
-                       , {"rc", rc()}
-                       , {"stderr", stderr()}
-                       , {"stdout", stdout()}
-                       , {"info", errorInfo()}
-                       , {"pwd", ps->workingDirectory()}};
+                       , {"cmd", cmd}
+                       , {"args", QVariant(args)}
+                       , {"rc", res.rc}
+                       , {"stderr", res.stderr}
+                       , {"stdout", res.stdout}
+                       , {"info", res.info}
+                       , {"pwd", pwd}};
     err.unite(error_info);
     error::raise(err);
 }
 
+}
+
+void Process::check_error(QVariantMap const &error_info)
+{
+    if (!rc())
+        return;
+    Result res;
+    res.rc = rc();
+    res.stderr = stderr();
+    res.stdout = stdout();
+    res.info = errorInfo();
+    checkResult(ps->program(), ps->arguments(), res, ps->workingDirectory()
+                , error_info);
+}
+
 QByteArray Process::check_output
 (QString const &cmd, QStringList const &args, QVariantMap const &error_info)
 {
@@ -135,9 +244,335 @@ QByteArray Process::stderr() const
 }
 
 
+Session::Session(QString const &cmd, QStringList const &args)
+    : cmd_(cmd)
+    , args_(args)
+    , sentinel_(QUuid::createUuid().toRfc4122().toHex())
+    , seq_(0)
+{
+    sentinel_.prepend("qtaround-session-");
+}
+
+Session::~Session()
+{
+    close();
+}
+
+bool Session::isRunning() const
+{
+    return ps_ && ps_->state() == QProcess::Running;
+}
+
+bool Session::ensureStarted()
+{
+    if (isRunning())
+        return true;
+    debug::info("Start session", cmd_, args_);
+    ps_.reset(new QProcess());
+    cwd_ = QDir::currentPath();
+    ps_->setWorkingDirectory(cwd_);
+    ps_->start(cmd_, args_);
+    return ps_->waitForStarted(-1);
+}
+
+void Session::close(int timeout)
+{
+    if (!ps_)
+        return;
+    if (ps_->state() != QProcess::NotRunning) {
+        ps_->closeWriteChannel();
+        if (!ps_->waitForFinished(timeout)) {
+            ps_->kill();
+            ps_->waitForFinished(-1);
+        }
+    }
+    ps_.reset();
+}
+
+QByteArray Session::frame(QByteArray const &cmd_line
+                          , QByteArray const &marker) const
+{
+    QByteArray res;
+    res.append("{ ").append(cmd_line).append("\n} < /dev/null\n");
+    res.append("printf '%s %d\\n' ").append(marker).append(" $?\n");
+    res.append("printf '%s\\n' ").append(marker).append(" >&2\n");
+    return res;
+}
+
+Result Session::execute(QString const &cmd, QStringList const &args
+                        , int timeout)
+{
+    QStringList cmd_line = {os::singleQuoted(cmd)};
+    for (auto const &arg : args)
+        cmd_line.push_back(os::singleQuoted(arg));
+    return execute(cmd_line.join(" "), timeout);
+}
+
+Result Session::execute(QString const &cmd_line, int timeout)
+{
+    if (!ensureStarted())
+        error::raise({{"msg", "Can't start session"}, {"cmd", cmd_}
+                , {"args", QVariant(args_)}});
+
+    auto marker = sentinel_ + "-" + QByteArray::number(++seq_);
+    debug::debug("Session execute", cmd_line);
+    ps_->write(frame(cmd_line.toUtf8(), marker));
+
+    QByteArray out, err;
+    int out_end = -1, err_end = -1;
+    QElapsedTimer timer;
+    timer.start();
+    while (true) {
+        out.append(ps_->readAllStandardOutput());
+        err.append(ps_->readAllStandardError());
+        if (out_end < 0) {
+            auto pos = out.indexOf(marker);
+            if (pos >= 0 && out.indexOf('\n', pos) >= 0)
+                out_end = pos;
+        }
+        if (err_end < 0)
+            err_end = err.indexOf(marker + "\n");
+        if (out_end >= 0 && err_end >= 0)
+            break;
+
+        auto left = -1;
+        if (timeout >= 0) {
+            left = timeout - timer.elapsed();
+            if (left <= 0)
+                left = 0;
+        }
+        ps_->setReadChannel(out_end < 0 ? QProcess::StandardOutput
+                            : QProcess::StandardError);
+        if (!ps_->waitForReadyRead(left)) {
+            if (ps_->state() != QProcess::Running)
+                error::raise({{"msg", "Session process exited"}
+                        , {"cmd", cmd_}, {"cmd_line", cmd_line}
+                        , {"rc", ps_->exitCode()}
+                        , {"stdout", out}, {"stderr", err}});
+            if (timeout >= 0 && timer.elapsed() >= timeout) {
+                // state is unknown, session is restarted next time
+                close(0);
+                error::raise({{"msg", "Session command timeout"}
+                        , {"cmd", cmd_}, {"cmd_line", cmd_line}
+                        , {"timeout", timeout}});
+            }
+        }
+    }
+
+    Result res;
+    auto rc_begin = out_end + marker.size();
+    res.rc = out.mid(rc_begin, out.indexOf('\n', rc_begin) - rc_begin)
+        .trimmed().toInt();
+    res.stdout = out.left(out_end);
+    res.stderr = err.left(err_end);
+    return res;
+}
+
+QByteArray Session::check_output
+(QString const &cmd, QStringList const &args, QVariantMap const &error_info)
+{
+    auto res = execute(cmd, args);
+    checkResult(cmd, args, res, cwd_, error_info);
+    return res.stdout;
+}
+
+int Session::check_call
+(QString const &cmd, QStringList const &args, QVariantMap const &error_info)
+{
+    auto res = execute(cmd, args);
+    checkResult(cmd, args, res, cwd_, error_info);
+    return res.rc;
+}
+
+int call(QString const &cmd, QStringList const &args)
+{
+    Result res;
+    if (forkserver::run(cmd, args, QDir::currentPath(), res))
+        return res.rc;
+
+    Process p;
+    p.start(cmd, args);
+    p.wait(-1);
+    return p.rc();
+}
+
+class Cache::Impl
+{
+public:
+    Impl()
+        : ttl_(1000), used_(0)
+        , hits_(0), misses_(0), expired_(0)
+    {}
+
+    struct Entry
+    {
+        QString cmd;
+        Result result;
+        qint64 expires;
+        quint64 used;
+    };
+
+    static qint64 now()
+    {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>
+            (steady_clock::now().time_since_epoch()).count();
+    }
+
+    static QByteArray key(QString const &cmd, QStringList const &args)
+    {
+        QByteArray res;
+        auto add = [&res](QByteArray const &s) {
+            res.append(s);
+            res.append('\0');
+        };
+        add(cmd.toUtf8());
+        for (auto const &arg : args)
+            add(arg.toUtf8());
+        add(QDir::currentPath().toUtf8());
+        uint env_hash = 0;
+        for (auto env = ::environ; env && *env; ++env)
+            env_hash = qHash(QByteArray(*env), env_hash);
+        res.append(QByteArray::number(env_hash));
+        return res;
+    }
+
+    // called with mutex_ locked
+    void cleanup(qint64 current)
+    {
+        auto lru = entries_.end();
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (it.value().expires <= current) {
+                it = entries_.erase(it);
+                ++expired_;
+                continue;
+            }
+            if (lru == entries_.end() || it.value().used < lru.value().used)
+                lru = it;
+            ++it;
+        }
+        if (entries_.size() >= max_size && lru != entries_.end())
+            entries_.erase(lru);
+    }
+
+    static const int max_size = 256;
+
+    mutable std::mutex mutex_;
+    int ttl_;
+    quint64 used_;
+    QHash<QByteArray, Entry> entries_;
+    quint64 hits_;
+    quint64 misses_;
+    quint64 expired_;
+};
+
+Cache::Cache() : impl_(new Impl()) {}
+
+Cache &Cache::instance()
+{
+    static Cache self;
+    return self;
+}
+
+void Cache::setTtl(int msec)
+{
+    std::lock_guard<std::mutex> l(impl_->mutex_);
+    impl_->ttl_ = msec;
+}
+
+int Cache::ttl() const
+{
+    std::lock_guard<std::mutex> l(impl_->mutex_);
+    return impl_->ttl_;
+}
+
+Result Cache::run(QString const &cmd, QStringList const &args)
+{
+    auto key = Impl::key(cmd, args);
+    {
+        std::lock_guard<std::mutex> l(impl_->mutex_);
+        auto it = impl_->entries_.find(key);
+        if (it != impl_->entries_.end()) {
+            if (it.value().expires > Impl::now()) {
+                ++impl_->hits_;
+                it.value().used = ++impl_->used_;
+                return it.value().result;
+            }
+            impl_->entries_.erase(it);
+            ++impl_->expired_;
+        }
+        ++impl_->misses_;
+    }
+
+    Result res;
+    if (!forkserver::run(cmd, args, QDir::currentPath(), res)) {
+        Process p;
+        p.start(cmd, args);
+        p.wait(-1);
+        res.rc = p.rc();
+        res.stdout = p.stdout();
+        res.stderr = p.stderr();
+        res.info = p.errorInfo();
+    }
+
+    if (!res.rc) {
+        std::lock_guard<std::mutex> l(impl_->mutex_);
+        auto current = Impl::now();
+        if (impl_->entries_.size() >= Impl::max_size)
+            impl_->cleanup(current);
+        impl_->entries_.insert
+            (key, Impl::Entry{cmd, res, current + impl_->ttl_, ++impl_->used_});
+    }
+    return res;
+}
+
+QByteArray Cache::check_output(QString const &cmd, QStringList const &args
+                               , QVariantMap const &error_info)
+{
+    auto res = run(cmd, args);
+    checkResult(cmd, args, res, QDir::currentPath(), error_info);
+    return res.stdout;
+}
+
+void Cache::invalidate()
+{
+    std::lock_guard<std::mutex> l(impl_->mutex_);
+    impl_->entries_.clear();
+}
+
+void Cache::invalidate(QString const &cmd)
+{
+    std::lock_guard<std::mutex> l(impl_->mutex_);
+    auto &entries = impl_->entries_;
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it.value().cmd == cmd)
+            it = entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+QVariantMap Cache::stats() const
+{
+    std::lock_guard<std::mutex> l(impl_->mutex_);
+    return {{"hits", impl_->hits_}, {"misses", impl_->misses_}
+        , {"expired", impl_->expired_}, {"size", impl_->entries_.size()}};
+}
+
+void Cache::resetStats()
+{
+    std::lock_guard<std::mutex> l(impl_->mutex_);
+    impl_->hits_ = impl_->misses_ = impl_->expired_ = 0;
+}
+
 QByteArray check_output(QString const &cmd, QStringList const &args
                         , QVariantMap const &error_info)
 {
+    Result res;
+    if (forkserver::run(cmd, args, QDir::currentPath(), res)) {
+        checkResult(cmd, args, res, QDir::currentPath(), error_info);
+        return res.stdout;
+    }
     Process p;
     return p.check_output(cmd, args, error_info);
 }
@@ -145,8 +580,356 @@ QByteArray check_output(QString const &cmd, QStringList const &args
 int check_call(QString const &cmd, QStringList const &args
                , QVariantMap const &error_info)
 {
+    Result res;
+    if (forkserver::run(cmd, args, QDir::currentPath(), res)) {
+        checkResult(cmd, args, res, QDir::currentPath(), error_info);
+        return res.rc;
+    }
     Process p;
     return p.check_call(cmd, args, error_info);
 }
 
+namespace {
+
+/**
+ * Lets cancellation request from other thread reach the object if it
+ * is still alive
+ */
+class AsyncGuard
+{
+public:
+    AsyncGuard(QObject *obj) : obj_(obj) {}
+
+    void invoke(std::function<void()> fn)
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        if (obj_)
+            mt::invokeLater(obj_, std::move(fn));
+    }
+
+    void reset()
+    {
+        std::lock_guard<std::mutex> l(mutex_);
+        obj_ = nullptr;
+    }
+
+private:
+    std::mutex mutex_;
+    QObject *obj_;
+};
+
+class AsyncProcess : public QObject
+{
+public:
+    AsyncProcess(QString const &cmd, QStringList const &args
+                 , QVariantMap const &options)
+        : cmd_(cmd)
+        , args_(args)
+        , cwd_(str(options.value("cwd")))
+        , guard_(std::make_shared<AsyncGuard>(this))
+    {
+        std::weak_ptr<AsyncGuard> guard = guard_;
+        promise_.onCancel([this, guard]() {
+                auto p = guard.lock();
+                if (p)
+                    p->invoke([this]() { kill(); });
+            });
+
+        auto timeout = options.value("timeout", -1).toInt();
+        if (timeout >= 0) {
+            auto timer = new QTimer(this);
+            timer->setSingleShot(true);
+            connect(timer, &QTimer::timeout, [this, timeout]() {
+                    debug::warning("Process timeout", cmd_, args_);
+                    kill();
+                    promise_.setError({{"msg", "Process timeout"}
+                            , {"cmd", cmd_}, {"args", QVariant(args_)}
+                            , {"timeout", timeout}});
+                });
+            timer->start(timeout);
+        }
+    }
+
+    virtual ~AsyncProcess()
+    {
+        guard_->reset();
+    }
+
+    mt::Future<Result> future() const
+    {
+        return promise_.future();
+    }
+
+protected:
+    virtual void kill() = 0;
+
+    void finish(Result const &res)
+    {
+        debug::info("Process is finished", cmd_, res.rc);
+        promise_.setValue(res);
+        deleteLater();
+    }
+
+    QString cmd_;
+    QStringList args_;
+    QString cwd_;
+
+private:
+    mt::Promise<Result> promise_;
+    std::shared_ptr<AsyncGuard> guard_;
+};
+
+class QProcessAsync : public AsyncProcess
+{
+public:
+    QProcessAsync(QString const &cmd, QStringList const &args
+                  , QVariantMap const &options)
+        : AsyncProcess(cmd, args, options)
+        , ps_(new QProcess(this))
+        , isFinished_(false)
+    {
+        connect(ps_, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>
+                (&QProcess::finished)
+                , [this](int rc, QProcess::ExitStatus status) {
+                    Result res;
+                    res.rc = (status == QProcess::NormalExit ? rc : 254);
+                    if (status != QProcess::NormalExit)
+                        res.info = errorNames[QProcess::Crashed];
+                    complete(res);
+                });
+        connect(ps_, static_cast<void (QProcess::*)(QProcess::ProcessError)>
+                (&QProcess::error), [this](QProcess::ProcessError err) {
+                    // other errors are followed by finished()
+                    if (err != QProcess::FailedToStart)
+                        return;
+                    Result res;
+                    res.rc = 254;
+                    res.stderr = errorNames[err].toUtf8();
+                    res.info = errorNames[err];
+                    complete(res);
+                });
+        if (!cwd_.isEmpty())
+            ps_->setWorkingDirectory(cwd_);
+        debug::info("Start async", cmd, args);
+        ps_->start(cmd, args);
+    }
+
+protected:
+    void kill() Q_DECL_OVERRIDE
+    {
+        if (ps_->state() != QProcess::NotRunning)
+            ps_->kill();
+    }
+
+private:
+    void complete(Result &res)
+    {
+        if (isFinished_)
+            return;
+        isFinished_ = true;
+        res.stdout = ps_->readAllStandardOutput();
+        res.stderr.append(ps_->readAllStandardError());
+        finish(res);
+    }
+
+    QProcess *ps_;
+    bool isFinished_;
+};
+
+class ForkServerAsync : public AsyncProcess
+{
+public:
+    ForkServerAsync(QString const &cmd, QStringList const &args
+                    , QVariantMap const &options)
+        : AsyncProcess(cmd, args, options)
+        , status_(-1)
+        , pid_(-1)
+        , isExited_(false)
+        , isKillRequested_(false)
+    {
+        for (int i = 0; i < 2; ++i) {
+            fds_[i] = -1;
+            notifiers_[i] = nullptr;
+        }
+    }
+
+    virtual ~ForkServerAsync()
+    {
+        for (auto fd : {fds_[0], fds_[1], status_})
+            if (fd >= 0)
+                ::close(fd);
+    }
+
+    bool start()
+    {
+        int in = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+        int out[2] = {-1, -1}, err[2] = {-1, -1};
+        auto cleanup = [&]() {
+            for (auto fd : {in, out[0], out[1], err[0], err[1]})
+                if (fd >= 0)
+                    ::close(fd);
+        };
+        if (in < 0 || ::pipe2(out, O_CLOEXEC | O_NONBLOCK) < 0
+            || ::pipe2(err, O_CLOEXEC | O_NONBLOCK) < 0) {
+            cleanup();
+            return false;
+        }
+        // child end should be blocking
+        for (auto fd : {out[1], err[1]})
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+        auto cwd = cwd_.isEmpty() ? QDir::currentPath() : cwd_;
+        int const fds[3] = {in, out[1], err[1]};
+        if (!forkserver::spawn(cmd_, args_, cwd, fds, status_)) {
+            cleanup();
+            return false;
+        }
+        debug::info("Start async", cmd_, args_, "using fork server");
+        for (auto &fd : {&in, &out[1], &err[1]}) {
+            ::close(*fd);
+            *fd = -1;
+        }
+        fds_[0] = out[0];
+        fds_[1] = err[0];
+        QByteArray *dst[2] = {&res_.stdout, &res_.stderr};
+        for (int i = 0; i < 2; ++i) {
+            notifiers_[i] = new QSocketNotifier(fds_[i], QSocketNotifier::Read, this);
+            auto data = dst[i];
+            connect(notifiers_[i], &QSocketNotifier::activated
+                    , [this, i, data](int) { onOutput(i, *data); });
+        }
+        auto status = new QSocketNotifier(status_, QSocketNotifier::Read, this);
+        connect(status, &QSocketNotifier::activated, [this, status](int) {
+                onStatus(status);
+            });
+        return true;
+    }
+
+protected:
+    void kill() Q_DECL_OVERRIDE
+    {
+        // if pid is not known yet, process is killed on start
+        isKillRequested_ = true;
+        if (pid_ > 0 && !isExited_)
+            ::kill(pid_, SIGKILL);
+    }
+
+private:
+    void onOutput(int i, QByteArray &dst)
+    {
+        char buf[64 * 1024];
+        while (true) {
+            auto n = ::read(fds_[i], buf, sizeof(buf));
+            if (n > 0) {
+                dst.append(buf, n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && errno == EAGAIN)
+                return;
+            break;
+        }
+        // EOF or error
+        notifiers_[i]->setEnabled(false);
+        ::close(fds_[i]);
+        fds_[i] = -1;
+        checkFinished();
+    }
+
+    void onStatus(QSocketNotifier *notifier)
+    {
+        forkserver::Reply reply;
+        if (!forkserver::readReply(status_, reply)) {
+            reply.type = static_cast<int32_t>(forkserver::ReplyType::Failed);
+            reply.value = EPIPE;
+        }
+        switch (static_cast<forkserver::ReplyType>(reply.type)) {
+        case forkserver::ReplyType::Started:
+            pid_ = reply.value;
+            if (isKillRequested_)
+                kill();
+            return;
+        case forkserver::ReplyType::Failed:
+            debug::warning("Process is failed to start", cmd_
+                           , ::strerror(reply.value));
+            res_.stderr.append(::strerror(reply.value));
+            break;
+        case forkserver::ReplyType::Exited:
+            res_.usage = reply.usage;
+            break;
+        }
+        res_.rc = forkserver::replyRc(reply);
+        res_.info = forkserver::replyInfo(reply);
+        isExited_ = true;
+        notifier->setEnabled(false);
+        checkFinished();
+    }
+
+    void checkFinished()
+    {
+        if (isExited_ && fds_[0] < 0 && fds_[1] < 0)
+            finish(res_);
+    }
+
+    int fds_[2];
+    QSocketNotifier *notifiers_[2];
+    int status_;
+    pid_t pid_;
+    bool isExited_;
+    bool isKillRequested_;
+    Result res_;
+};
+
+}
+
+mt::Future<Result> run_async(QString const &cmd, QStringList const &args
+                             , QVariantMap const &options)
+{
+    if (isForkServerRunning()) {
+        auto p = new ForkServerAsync(cmd, args, options);
+        if (p->start())
+            return p->future();
+        delete p;
+    }
+    auto p = new QProcessAsync(cmd, args, options);
+    return p->future();
+}
+
+namespace {
+
+QString asyncPwd(QVariantMap const &options)
+{
+    auto cwd = str(options.value("cwd"));
+    return cwd.isEmpty() ? QDir::currentPath() : cwd;
+}
+
+}
+
+mt::Future<QByteArray> check_output_async
+(QString const &cmd, QStringList const &args
+ , QVariantMap const &error_info, QVariantMap const &options)
+{
+    auto pwd = asyncPwd(options);
+    return run_async(cmd, args, options).then
+        ([cmd, args, pwd, error_info](mt::Future<Result> f) {
+            auto res = f.get();
+            checkResult(cmd, args, res, pwd, error_info);
+            return res.stdout;
+        });
+}
+
+mt::Future<int> check_call_async
+(QString const &cmd, QStringList const &args
+ , QVariantMap const &error_info, QVariantMap const &options)
+{
+    auto pwd = asyncPwd(options);
+    return run_async(cmd, args, options).then
+        ([cmd, args, pwd, error_info](mt::Future<Result> f) {
+            auto res = f.get();
+            checkResult(cmd, args, res, pwd, error_info);
+            return res.rc;
+        });
+}
+
 }}
@@ -0,0 +1,230 @@
+/**
+ * @file timerwheel.cpp
+ * @brief Hierarchical timer wheel used for actor timers
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include "timerwheel.hpp"
+
+#include <qtaround/debug.hpp>
+
+#include <limits>
+
+namespace qtaround { namespace mt {
+
+static const quint64 never = std::numeric_limits<quint64>::max();
+
+TimerWheel &TimerWheel::instance()
+{
+    static TimerWheel self;
+    return self;
+}
+
+TimerWheel::TimerWheel()
+    : start_(std::chrono::steady_clock::now())
+    , current_(0)
+    , wakeupAt_(never)
+    , lastId_(0)
+    , isStopped_(false)
+{
+    level0_.fill(nullptr);
+    for (auto &level : levels_)
+        level.fill(nullptr);
+    thread_ = std::thread([this]() { run(); });
+}
+
+TimerWheel::~TimerWheel()
+{
+    do {
+        std::lock_guard<std::mutex> l(mutex_);
+        isStopped_ = true;
+        cond_.notify_all();
+    } while (0);
+    thread_.join();
+    for (auto &kv : timers_)
+        delete kv.second;
+}
+
+quint64 TimerWheel::now() const
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now() - start_).count();
+}
+
+quint64 TimerWheel::add(unsigned long msec, unsigned long period
+                        , callback_type fn)
+{
+    std::lock_guard<std::mutex> l(mutex_);
+    skipIdle(now());
+    auto t = new Timer{++lastId_, std::max(now() + msec, current_ + 1)
+                       , period, std::move(fn), nullptr, nullptr, nullptr};
+    place(t);
+    timers_[t->id] = t;
+    if (t->expires < wakeupAt_)
+        cond_.notify_one();
+    return t->id;
+}
+
+bool TimerWheel::cancel(quint64 id)
+{
+    std::lock_guard<std::mutex> l(mutex_);
+    auto it = timers_.find(id);
+    if (it == timers_.end())
+        return false;
+    auto t = it->second;
+    timers_.erase(it);
+    // timer being fired is deleted by the timer thread
+    if (t->slot) {
+        unlink(t);
+        delete t;
+    }
+    return true;
+}
+
+void TimerWheel::skipIdle(quint64 ticks)
+{
+    // empty wheel is not stepped, otherwise timer thread would step
+    // through the whole idle period tick by tick under the lock
+    if (timers_.empty() && current_ < ticks)
+        current_ = ticks;
+}
+
+void TimerWheel::place(Timer *t)
+{
+    auto delta = std::min<quint64>(t->expires - current_, max_delta);
+    auto expires = current_ + delta;
+    Timer **slot = nullptr;
+    if (delta < level0_size) {
+        slot = &level0_[expires & (level0_size - 1)];
+    } else {
+        for (int level = 1; level < levels_count; ++level) {
+            auto shift = level0_bits + level * level_bits;
+            if (delta < (1ULL << shift) || level == levels_count - 1) {
+                auto index = (expires >> (shift - level_bits)) & (level_size - 1);
+                slot = &levels_[level - 1][index];
+                break;
+            }
+        }
+    }
+    t->slot = slot;
+    t->prev = nullptr;
+    t->next = *slot;
+    if (t->next)
+        t->next->prev = t;
+    *slot = t;
+}
+
+void TimerWheel::unlink(Timer *t)
+{
+    if (t->prev)
+        t->prev->next = t->next;
+    else
+        *t->slot = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+    t->prev = t->next = nullptr;
+    t->slot = nullptr;
+}
+
+void TimerWheel::cascade(int level)
+{
+    auto shift = level0_bits + (level - 1) * level_bits;
+    auto index = (current_ >> shift) & (level_size - 1);
+    if (!index && level + 1 < levels_count)
+        cascade(level + 1);
+
+    auto &slot = levels_[level - 1][index];
+    auto t = slot;
+    slot = nullptr;
+    while (t) {
+        auto next = t->next;
+        place(t);
+        t = next;
+    }
+}
+
+void TimerWheel::step(std::vector<Timer*> &expired)
+{
+    ++current_;
+    auto index = current_ & (level0_size - 1);
+    if (!index)
+        cascade(1);
+
+    auto &slot = level0_[index];
+    auto t = slot;
+    slot = nullptr;
+    while (t) {
+        auto next = t->next;
+        t->prev = t->next = nullptr;
+        t->slot = nullptr;
+        if (t->expires > current_)
+            place(t); // parked beyond the wheel range
+        else
+            expired.push_back(t);
+        t = next;
+    }
+}
+
+quint64 TimerWheel::nextWakeup() const
+{
+    if (timers_.empty())
+        return never;
+    // timers of upper levels can become due right after the next
+    // cascade, so level 0 is scanned only up to it
+    auto cascade = ((current_ >> level0_bits) + 1) << level0_bits;
+    for (quint64 tick = current_ + 1; tick < cascade; ++tick) {
+        if (level0_[tick & (level0_size - 1)])
+            return tick;
+    }
+    return cascade;
+}
+
+void TimerWheel::run()
+{
+    std::unique_lock<std::mutex> l(mutex_);
+    std::vector<Timer*> expired;
+    while (!isStopped_) {
+        auto ticks = now();
+        skipIdle(ticks);
+        while (current_ < ticks)
+            step(expired);
+
+        if (!expired.empty()) {
+            l.unlock();
+            std::vector<bool> is_kept(expired.size());
+            for (size_t i = 0; i < expired.size(); ++i) {
+                auto t = expired[i];
+                try {
+                    is_kept[i] = t->fn() && t->period;
+                } catch (std::exception const &e) {
+                    debug::warning("Timer callback exception:", e.what());
+                }
+            }
+            l.lock();
+            for (size_t i = 0; i < expired.size(); ++i) {
+                auto t = expired[i];
+                auto it = timers_.find(t->id);
+                if (is_kept[i] && it != timers_.end()) {
+                    t->expires = std::max(t->expires + t->period, current_ + 1);
+                    place(t);
+                } else {
+                    if (it != timers_.end())
+                        timers_.erase(it);
+                    delete t;
+                }
+            }
+            expired.clear();
+            continue;
+        }
+
+        wakeupAt_ = nextWakeup();
+        if (wakeupAt_ == never)
+            cond_.wait(l);
+        else
+            cond_.wait_until(l, start_ + std::chrono::milliseconds(wakeupAt_));
+        wakeupAt_ = never;
+    }
+}
+
+}}
@@ -0,0 +1,95 @@
+#ifndef _QTAROUND_TIMERWHEEL_HPP_
+#define _QTAROUND_TIMERWHEEL_HPP_
+/**
+ * @file timerwheel.hpp
+ * @brief Hierarchical timer wheel used for actor timers
+ * @copyright (C) 2014 Jolla Ltd.
+ * @par License: LGPL 2.1 http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html
+ */
+
+#include <QtGlobal>
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace qtaround { namespace mt {
+
+/**
+ * Timers with 1ms resolution served by the single thread. Wheel has
+ * 4 levels (256 slots for the nearest 256ms and 64 slots for each next
+ * level), timers are cascaded to lower levels when they come closer,
+ * so insert and cancel are O(1). Timers farther than ~18h are
+ * parked in the last slot of the top level and placed again when it
+ * is reached.
+ */
+class TimerWheel
+{
+public:
+    /// executed in the timer thread, periodic timer is stopped if it
+    /// returns false
+    typedef std::function<bool()> callback_type;
+
+    static TimerWheel &instance();
+
+    ~TimerWheel();
+
+    /// @return timer id, it is never 0
+    quint64 add(unsigned long msec, unsigned long period, callback_type);
+    bool cancel(quint64 id);
+
+private:
+    struct Timer
+    {
+        quint64 id;
+        quint64 expires;
+        unsigned long period;
+        callback_type fn;
+        Timer *prev;
+        Timer *next;
+        Timer **slot;
+    };
+
+    enum {
+        level0_bits = 8,
+        level_bits = 6,
+        levels_count = 4,
+        level0_size = 1 << level0_bits,
+        level_size = 1 << level_bits,
+        max_delta = (1 << (level0_bits + (levels_count - 1) * level_bits)) - 1
+    };
+
+    TimerWheel();
+
+    quint64 now() const;
+    void run();
+    void skipIdle(quint64 ticks);
+    void place(Timer *);
+    void unlink(Timer *);
+    void cascade(int level);
+    void step(std::vector<Timer*> &expired);
+    quint64 nextWakeup() const;
+
+    std::array<Timer*, level0_size> level0_;
+    std::array<std::array<Timer*, level_size>, levels_count - 1> levels_;
+    std::unordered_map<quint64, Timer*> timers_;
+    std::chrono::steady_clock::time_point start_;
+    // ticks (msec) since start_ processed by the wheel
+    quint64 current_;
+    quint64 wakeupAt_;
+    quint64 lastId_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    bool isStopped_;
+    std::thread thread_;
+};
+
+}}
+
+#endif // _QTAROUND_TIMERWHEEL_HPP_
@@ -6,12 +6,14 @@
  */
 
 #include <qtaround/util.hpp>
-#include <qtaround/debug.hpp>
+#include <qtaround/parallel.hpp>
 
 #include <QString>
 #include <QMap>
 
+#include <algorithm>
 #include <cmath>
+#include <vector>
 
 namespace qtaround {
 
@@ -38,75 +40,392 @@ namespace util {
 
 namespace {
 
+/// multiplier suffixes, exponent is index + 1
+constexpr char capacity_units[] = "kmgtpezy";
+constexpr char capacity_units_upper[] = "KMGTPEZY";
+constexpr long capacity_units_count = sizeof(capacity_units) - 1;
+
+constexpr long capacityLetterExponent(char c, long i = 0)
+{
+    return i == capacity_units_count ? -1
+        : (capacity_units[i] == c ? i + 1 : capacityLetterExponent(c, i + 1));
+}
+
+static_assert(capacityLetterExponent('k') == 1
+              && capacityLetterExponent('y') == 8
+              && capacityLetterExponent('b') == -1
+              , "Wrong capacity units table");
+
+inline bool isAsciiUpper(ushort c)
+{
+    return c >= 'A' && c <= 'Z';
+}
+
+/**
+ * The same as matching name.toLower().trimmed() against
+ * "^([kmgtpezy]?)i?b?$" but without temporary strings
+ */
 long capacityUnitExponent(QString const &name)
 {
-    static const QMap<QChar, long> multipliers = {
-        {'k', 1}, {'m', 2}, {'g', 3}, {'t', 4}, {'p', 5}
-        , {'e', 6}, {'z', 7}, {'y', 8} };
-    static const QRegExp unit_re("^([kmgtpezy]?)i?b?$");
-    auto suffix = name.toLower().trimmed();
-    if (!unit_re.exactMatch(suffix))
-        error::raise({{"msg", "Wrong bytes unit format"}, {"suffix", suffix}});
+    auto suffix = name.constData();
+    int begin = 0, end = name.size();
+    QString lowered;
+    for (int i = 0; i < end; ++i) {
+        if (suffix[i].unicode() >= 0x80) {
+            // full Unicode case mapping can change the length
+            lowered = name.toLower();
+            suffix = lowered.constData();
+            end = lowered.size();
+            break;
+        }
+    }
+    while (begin < end && suffix[begin].isSpace())
+        ++begin;
+    while (end > begin && suffix[end - 1].isSpace())
+        --end;
+
+    auto at = [suffix, end](int pos) -> char {
+        if (pos >= end)
+            return '\0';
+        auto c = suffix[pos].unicode();
+        if (c >= 0x80)
+            return '\0';
+        return static_cast<char>(isAsciiUpper(c) ? c - 'A' + 'a' : c);
+    };
+    auto pos = begin;
+    auto exp = capacityLetterExponent(at(pos));
+    if (exp > 0)
+        ++pos;
+    if (at(pos) == 'i')
+        ++pos;
+    if (at(pos) == 'b')
+        ++pos;
+    if (pos != end)
+        error::raise({{"msg", "Wrong bytes unit format"}
+                      , {"suffix", name.toLower().trimmed()}});
 
     if (name == QChar('b'))
         return 0;
 
-    auto exp = multipliers.value(suffix[0], -1);
     if (exp == -1)
         error::raise({{"msg", "Wrong bytes unit multiplier"}
-                      , {"suffix", suffix}});
+                      , {"suffix", name.toLower().trimmed()}});
     return exp;
 }
 
+inline bool isNumberChar(QChar c)
+{
+    auto v = c.unicode();
+    return (v >= '0' && v <= '9') || v == '.' || v == ',';
+}
+
+/**
+ * QString::toDouble() of the [0-9.,]* string. Up to 15 significant
+ * digits and 22 digits after the point are converted exactly, other
+ * cases are passed to QString::toDouble()
+ */
+bool parseNumber(QChar const *s, int len, double &res)
+{
+    static const double pow10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11
+        , 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21
+        , 1e22 };
+    static const int max_digits = 15;
+    static const int max_fraction = sizeof(pow10) / sizeof(pow10[0]) - 1;
+
+    if (!len)
+        return false;
+    unsigned long long mantissa = 0;
+    int digits = 0, fraction = -1;
+    // separators and points at edges are left to Qt
+    bool is_fast = s[0].unicode() != '.' && s[len - 1].unicode() != '.';
+    for (int i = 0; is_fast && i < len; ++i) {
+        auto c = s[i].unicode();
+        if (c == '.') {
+            if (fraction >= 0)
+                is_fast = false;
+            fraction = 0;
+        } else if (c == ',') {
+            is_fast = false;
+        } else {
+            if (mantissa || c != '0')
+                ++digits;
+            mantissa = mantissa * 10 + (c - '0');
+            if (fraction >= 0)
+                ++fraction;
+            is_fast = digits <= max_digits && fraction <= max_fraction;
+        }
+    }
+    if (!is_fast) {
+        bool ok = false;
+        res = QString(s, len).toDouble(&ok);
+        return ok;
+    }
+    // both operands are exact, so the quotient is correctly rounded
+    res = static_cast<double>(mantissa) / pow10[std::max(fraction, 0)];
+    return true;
+}
+
 }
 
 double parseBytes(QString const &s, QString const &unit, long multiplier)
 {
-    debug::debug("parseBytes", s, unit);
-    auto value = s.trimmed();
-    static const QRegExp not_num_re("[^0-9.,]");
-    auto num_end = value.indexOf(not_num_re);
-    double res;
-    bool ok = false;
-    if (num_end == -1) {
-        res = value.toDouble(&ok);
-    } else {
-        res = value.left(num_end).toDouble(&ok);
-        auto exp = capacityUnitExponent(value.mid(num_end));
-
-        if (unit != "b" && unit != "B")
+    auto data = s.constData();
+    int begin = 0, end = s.size();
+    while (begin < end && data[begin].isSpace())
+        ++begin;
+    while (end > begin && data[end - 1].isSpace())
+        --end;
+    auto num_end = begin;
+    while (num_end < end && isNumberChar(data[num_end]))
+        ++num_end;
+
+    double res = 0;
+    bool ok = parseNumber(data + begin, num_end - begin, res);
+    if (num_end != end) {
+        auto exp = capacityUnitExponent
+            (QString::fromRawData(data + num_end, end - num_end));
+
+        if (unit != QLatin1String("b") && unit != QLatin1String("B"))
             exp -= capacityUnitExponent(unit);
 
         res = res * pow(multiplier, exp);
     }
     if (!ok)
-        error::raise({{"msg", "Can't parse bytes"}, {"value", value}});
+        error::raise({{"msg", "Can't parse bytes"}, {"value", s.trimmed()}});
+    return res;
+}
+
+QString formatBytes(double value, QString const &unit, long multiplier
+                    , int precision)
+{
+    if (!(value >= 0) || std::isinf(value))
+        error::raise({{"msg", "Can't format bytes"}, {"value", value}});
+
+    auto bytes = value;
+    if (unit != QLatin1String("b") && unit != QLatin1String("B"))
+        bytes *= pow(multiplier, capacityUnitExponent(unit));
+
+    auto scale = pow(10, precision);
+    auto rounded = std::round(bytes * scale) / scale;
+    long exp = 0;
+    while (exp < capacity_units_count && rounded >= multiplier) {
+        bytes /= multiplier;
+        rounded = std::round(bytes * scale) / scale;
+        ++exp;
+    }
+    auto res = QString::number(rounded, 'f', precision);
+    if (precision > 0) {
+        auto len = res.size();
+        while (res[len - 1] == QChar('0'))
+            --len;
+        if (res[len - 1] == QChar('.'))
+            --len;
+        res.truncate(len);
+    }
+    if (exp)
+        res += QChar(capacity_units_upper[exp - 1]);
+    return res;
+}
+
+namespace {
+
+/// iterates over children of the map or list without copying it
+class Children
+{
+public:
+    Children(QVariant const &v)
+        : map_(nullptr), list_(nullptr), index_(0)
+    {
+        if (hasType(v, QMetaType::QVariantMap)) {
+            map_ = static_cast<QVariantMap const*>(v.constData());
+            it_ = map_->begin();
+        } else if (hasType(v, QMetaType::QVariantList)) {
+            list_ = static_cast<QVariantList const*>(v.constData());
+        }
+    }
+
+    bool isContainer() const { return map_ || list_; }
+    bool isMap() const { return !!map_; }
+
+    bool next(QVariant &key, QVariant const *&value)
+    {
+        if (map_) {
+            if (it_ == map_->end())
+                return false;
+            key = it_.key();
+            value = &it_.value();
+            ++it_;
+        } else if (list_) {
+            if (index_ >= list_->size())
+                return false;
+            key = index_;
+            value = &list_->at(index_++);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    QVariantMap const *map_;
+    QVariantMap::const_iterator it_;
+    QVariantList const *list_;
+    int index_;
+};
+
+}
+
+static QVariant visitTree(visitor_type const &visitor, QVariant const &ctx
+                   , QVariant const &key, QVariant const &src)
+{
+    struct Frame
+    {
+        QVariant ctx;
+        Children children;
+    };
+    std::vector<Frame> stack;
+    auto enter = [&visitor, &stack](QVariant const &ctx, QVariant const &key
+                                    , QVariant const &value) {
+        auto res = visitor(ctx, key, value);
+        Children children(value);
+        if (children.isContainer())
+            stack.push_back(Frame{res, children});
+        return res;
+    };
+
+    auto res = enter(ctx, key, src);
+    QVariant child_key;
+    QVariant const *child;
+    while (!stack.empty()) {
+        auto &top = stack.back();
+        if (!top.children.next(child_key, child)) {
+            stack.pop_back();
+            continue;
+        }
+        // stack can be reallocated by enter()
+        auto child_ctx = top.ctx;
+        enter(child_ctx, child_key, *child);
+    }
     return res;
 }
 
 QVariant visit(visitor_type visitor, QVariant const &src, QVariant const &ctx)
 {
-    visitor_type visit_obj;
-    visit_obj = [&visitor, &visit_obj](QVariant const &ctx
-                                       , QVariant const &key
-                                       , QVariant const &src) {
-        auto process_obj = [visit_obj]
-        (QVariant const &ctx, QVariant const &src) {
-            if (hasType(src, QMetaType::QVariantMap)) {
-                auto m = src.toMap();
-                for (auto it = m.begin(); it != m.end(); ++it)
-                    visit_obj(ctx, it.key(), it.value());
-            } else if (hasType(src, QMetaType::QVariantList)) {
-                auto l = src.toList();
-                int i = 0;
-                for (auto it = l.begin(); it != l.end(); ++it, ++i)
-                    visit_obj(ctx, i, *it);
+    return visitTree(visitor, ctx, QVariant(), src);
+}
+
+QVariant visit_parallel(visitor_type visitor, QVariant const &src
+                        , QVariant const &ctx, mt::Executor &executor)
+{
+    struct Subtree
+    {
+        QVariant ctx;
+        QVariant key;
+        QVariant const *value;
+    };
+    auto add_children = [](QVariant const &ctx, QVariant const &value
+                           , std::vector<Subtree> &dst) {
+        Children children(value);
+        QVariant key;
+        QVariant const *child;
+        while (children.next(key, child))
+            dst.push_back(Subtree{ctx, key, child});
+    };
+    auto is_container = [](Subtree const &t) {
+        return Children(*t.value).isContainer();
+    };
+
+    auto res = visitor(ctx, QVariant(), src);
+    // split the tree breadth-first until there are enough subtrees
+    // for all workers, split nodes are visited here
+    std::vector<Subtree> subtrees, next;
+    add_children(res, src, subtrees);
+    auto enough = executor.size() * 4;
+    while (subtrees.size() < enough
+           && std::any_of(subtrees.begin(), subtrees.end(), is_container)) {
+        next.clear();
+        for (auto const &t : subtrees) {
+            if (is_container(t))
+                add_children(visitor(t.ctx, t.key, *t.value), *t.value, next);
+            else
+                next.push_back(t);
+        }
+        subtrees.swap(next);
+    }
+    executor.parallel_for(0, subtrees.size(), [&visitor, &subtrees](size_t i) {
+            auto const &t = subtrees[i];
+            visitTree(visitor, t.ctx, t.key, *t.value);
+        });
+    return res;
+}
+
+QVariant transform(transformer_type transformer, QVariant const &src)
+{
+    QVariant replacement;
+    if (transformer(QVariant(), src, replacement))
+        return replacement;
+
+    struct Frame
+    {
+        Frame(QVariant const &src, QVariant const &key)
+            : src_(&src), children_(src), key_(key), isModified_(false)
+        {}
+
+        void set(QVariant const &key, QVariant const &value)
+        {
+            if (!isModified_) {
+                isModified_ = true;
+                if (children_.isMap())
+                    map_ = src_->toMap();
+                else
+                    list_ = src_->toList();
             }
-            return ctx;
-        };
-        return process_obj(visitor(ctx, key, src), src);
+            if (children_.isMap())
+                map_.insert(key.toString(), value);
+            else
+                list_[key.toInt()] = value;
+        }
+
+        QVariant result() const
+        {
+            return children_.isMap() ? QVariant(map_) : QVariant(list_);
+        }
+
+        QVariant const *src_;
+        Children children_;
+        QVariant key_;
+        bool isModified_;
+        QVariantMap map_;
+        QVariantList list_;
     };
-    return visit_obj(ctx, QVariant(), src);
+
+    if (!Children(src).isContainer())
+        return src;
+
+    std::vector<Frame> stack;
+    stack.emplace_back(src, QVariant());
+    QVariant key;
+    QVariant const *child;
+    while (true) {
+        auto &top = stack.back();
+        if (top.children_.next(key, child)) {
+            replacement = QVariant();
+            if (transformer(key, *child, replacement))
+                top.set(key, replacement);
+            else if (Children(*child).isContainer())
+                stack.emplace_back(*child, key);
+            continue;
+        }
+        auto is_modified = top.isModified_;
+        auto res = is_modified ? top.result() : QVariant();
+        key = top.key_;
+        stack.pop_back();
+        if (stack.empty())
+            return is_modified ? res : src;
+        if (is_modified)
+            stack.back().set(key, res);
+    }
 }
 
 
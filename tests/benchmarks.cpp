@@ -0,0 +1,174 @@
+#include <qtaround/subprocess.hpp>
+#include <qtaround/channel.hpp>
+#include <qtaround/util.hpp>
+#include <tut/tut.hpp>
+#include "tests_common.hpp"
+#include "bytes_ref.hpp"
+
+#include <QElapsedTimer>
+
+#include <cor/util.hpp>
+
+#include <cmath>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <vector>
+
+namespace subprocess = qtaround::subprocess;
+namespace mt = qtaround::mt;
+namespace util = qtaround::util;
+
+namespace tut
+{
+
+struct benchmarks_test
+{
+    virtual ~benchmarks_test()
+    {
+    }
+};
+
+typedef test_group<benchmarks_test> tf;
+typedef tf::object object;
+tf vault_benchmarks_test("benchmarks");
+
+enum test_ids {
+    tid_spawn = 1
+    , tid_channel
+    , tid_str
+    , tid_parse_bytes
+};
+
+namespace {
+
+/// run fn count times and print the time spent
+qint64 measure(char const *name, int count, std::function<void()> const &fn)
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < count; ++i)
+        fn();
+    auto ms = timer.elapsed();
+    std::cout << name << ": " << count << " iterations, " << ms << " ms, "
+              << (ms * 1000.0 / count) << " us/iteration" << std::endl;
+    return ms;
+}
+
+}
+
+template<> template<>
+void object::test<tid_spawn>()
+{
+    int const count = 200;
+    auto spawn = []() {
+        subprocess::check_call("true", {});
+    };
+    measure("QProcess spawn", count, spawn);
+
+    ensure("Should start fork server", subprocess::startForkServer());
+    auto stop = cor::on_scope_exit([]() { subprocess::stopForkServer(); });
+    measure("Fork server spawn", count, spawn);
+}
+
+template<> template<>
+void object::test<tid_channel>()
+{
+    int const count = 1000000;
+    mt::Channel<int> spsc(1024);
+    auto consumer = std::async(std::launch::async, [&spsc]() {
+            int v;
+            while (spsc.receive(v)) {}
+        });
+    measure("SPSC channel send", count, [&spsc]() { spsc.send(0); });
+    spsc.close();
+    consumer.get();
+
+    int const producers = 4, consumers = 4;
+    mt::Channel<int> mpmc(1024);
+    std::vector<std::future<void> > received;
+    for (int i = 0; i < consumers; ++i) {
+        received.push_back(std::async(std::launch::async, [&mpmc]() {
+                    int v;
+                    while (mpmc.receive(v)) {}
+                }));
+    }
+    measure("MPMC channel, 4 producers", 1, [&mpmc]() {
+            std::vector<std::future<void> > sent;
+            for (int i = 0; i < producers; ++i) {
+                sent.push_back(std::async(std::launch::async, [&mpmc]() {
+                            for (int j = 0; j < count / producers; ++j)
+                                mpmc.send(j);
+                        }));
+            }
+            for (auto &f : sent)
+                f.get();
+        });
+    mpmc.close();
+    for (auto &f : received)
+        f.get();
+}
+
+template<> template<>
+void object::test<tid_str>()
+{
+    int const count = 200000;
+    QString s("s");
+    QByteArray b("b");
+    int total = 0, i = 0;
+
+    measure("2 args pairwise", count, [&]() {
+            total += (s + QString::number(++i)).size();
+        });
+    i = 0;
+    measure("2 args str()", count, [&]() {
+            total -= str(s, ++i).size();
+        });
+
+    i = 0;
+    measure("5 args pairwise", count, [&]() {
+            ++i;
+            total += (s + QString::number(i) + QString("/")
+                      + QString::fromUtf8(b) + QString::number(i)).size();
+        });
+    i = 0;
+    measure("5 args str()", count, [&]() {
+            ++i;
+            total -= str(s, i, "/", b, i).size();
+        });
+
+    i = 0;
+    measure("10 args pairwise", count, [&]() {
+            ++i;
+            total += (s + QString::number(i) + QString("/")
+                      + QString::fromUtf8(b) + QString::number(i)
+                      + s + QString::number(i) + QString("/")
+                      + QString::fromUtf8(b) + QString::number(i)).size();
+        });
+    i = 0;
+    measure("10 args str()", count, [&]() {
+            ++i;
+            total -= str(s, i, "/", b, i, s, i, "/", b, i).size();
+        });
+
+    ensure_eq("Same lengths", total, 0);
+}
+
+template<> template<>
+void object::test<tid_parse_bytes>()
+{
+    QStringList lines = {"12345K", " 40 kb ", "1.5G", "1024", "7.25Mib"};
+    int const count = 50000;
+    int i = 0;
+    double total = 0;
+    measure("parseBytes QRegExp", count, [&]() {
+            total += parseBytesRef(lines[i++ % lines.size()], "K", 1024);
+        });
+    i = 0;
+    measure("parseBytes", count, [&]() {
+            total -= util::parseBytes(lines[i++ % lines.size()], "K", 1024);
+        });
+    ensure("Same results", std::abs(total) < 1e-6);
+}
+
+}
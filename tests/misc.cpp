@@ -1,12 +1,23 @@
 #include <qtaround/util.hpp>
 #include <qtaround/os.hpp>
+#include <qtaround/parallel.hpp>
+#include <qtaround/range.hpp>
 #include <tut/tut.hpp>
 #include "tests_common.hpp"
+#include "bytes_ref.hpp"
 #include <qtaround/util.hpp>
 
 #include <QDebug>
+#include <QRegExp>
 #include <QVariant>
 
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <random>
+
 namespace os = qtaround::os;
 namespace error = qtaround::error;
 namespace util = qtaround::util;
@@ -30,6 +41,11 @@ enum test_ids {
     , tid_zip
     , tid_parsebytes
     , tid_error
+    , tid_parallel
+    , tid_range
+    , tid_visit_transform
+    , tid_str
+    , tid_bytes_fuzz
 };
 
 template<> template<>
@@ -128,4 +144,336 @@ void object::test<tid_error>()
     }
 }
 
+template<> template<>
+void object::test<tid_parallel>()
+{
+    QList<int> src;
+    for (int i = 0; i < 100000; ++i)
+        src.push_back(i);
+    auto square = [](int v) { return (qint64)v * v; };
+    auto expected = util::map<qint64>(square, src);
+    ensure_eq("Reserved map size", expected.size(), src.size());
+
+    auto res = util::parallel_map<qint64>(square, src);
+    ensure_eq("Map is the same as sequential", res, expected);
+    ensure_eq("Small grain", util::parallel_map<qint64>(square, src, 7)
+              , expected);
+    ensure_eq("Small input", util::parallel_map<qint64>(square, src.mid(0, 10))
+              , expected.mid(0, 10));
+    ensure_eq("Empty input"
+              , util::parallel_map<qint64>(square, QList<int>()).size(), 0);
+
+    auto is_odd = [](int v) { return v % 2; };
+    auto odd = util::parallel_filter(is_odd, src);
+    ensure_eq("Filtered size", odd.size(), src.size() / 2);
+    bool is_ordered = true;
+    for (int i = 0; i < odd.size(); ++i)
+        is_ordered = is_ordered && odd[i] == 2 * i + 1;
+    ensure("Filter preserves order", is_ordered);
+
+    auto sum = util::parallel_reduce([](qint64 acc, int v) { return acc + v; }
+                                     , [](qint64 a, qint64 b) { return a + b; }
+                                     , (qint64)0, src);
+    ensure_eq("Sum", sum, (qint64)99999 * 100000 / 2);
+
+    QStringList words;
+    for (int i = 0; i < 5000; ++i)
+        words.push_back(QString::number(i % 10));
+    auto concat = util::parallel_reduce
+        ([](QString const &a, QString const &b) { return a + b; }
+         , QString(), words, 100);
+    ensure_eq("Non-commutative reduce keeps order", concat, words.join(""));
+
+    ensure_throws<error::Error>("Exception is rethrown", [&src]() {
+            util::parallel_map<int>([](int v) {
+                    if (v == 5000)
+                        error::raise({{"msg", "Failed"}});
+                    return v;
+                }, src, 100);
+        });
+}
+
+namespace {
+
+/// counts live objects to compare eager and lazy pipelines memory usage
+struct Tracked
+{
+    Tracked(int v = 0) : value(v) { created(); }
+    Tracked(Tracked const &from) : value(from.value) { created(); }
+    ~Tracked() { --live; }
+    Tracked &operator = (Tracked const &) = default;
+
+    static void created()
+    {
+        if (++live > peak)
+            peak = live;
+    }
+
+    int value;
+    static size_t live;
+    static size_t peak;
+};
+
+size_t Tracked::live = 0;
+size_t Tracked::peak = 0;
+
+}
+
+template<> template<>
+void object::test<tid_range>()
+{
+    auto lines = util::split("a 1\n\nb 2\nc 3\n", '\n', QString::SkipEmptyParts)
+        .toList();
+    ensure_eq("Split skipping empty", lines, QList<QString>({"a 1", "b 2", "c 3"}));
+    ensure_eq("Split keeping empty", util::split("a,,b,", ',').toList()
+              , QList<QString>({"a", "", "b", ""}));
+    ensure_eq("Split empty", util::split("", ',').toList().size(), 1);
+
+    auto parse = [](QString const &line) {
+        auto nv = line.split(" ");
+        return std::make_tuple(nv[0], nv[1].toInt());
+    };
+    auto values = util::from(lines).map(parse).toMap();
+    ensure_eq("Map of parsed", values.size(), 3);
+    ensure_eq("Parsed value", values["b"], 2);
+
+    QList<int> src;
+    for (int i = 0; i < 100; ++i)
+        src.push_back(i);
+    int calls = 0;
+    auto square = [&calls](int v) { ++calls; return v * v; };
+    auto is_even = [](int v) { return v % 2 == 0; };
+    auto res = util::from(src).filter(is_even).map(square).take(3).toList();
+    ensure_eq("Filter, map and take", res, QList<int>({0, 4, 16}));
+    ensure_eq("Pipeline is lazy", calls, 3);
+
+    auto sum = util::from(src).reduce(0, [](int acc, int v) { return acc + v; });
+    ensure_eq("Reduce", sum, 4950);
+
+    QStringList names = {"src", "dst", "type"};
+    auto zipped = util::zip(util::from(names), util::from(QStringList({"a", "b"})))
+        .toMap();
+    ensure_eq("Zip", zipped["src"], QString("a"));
+    ensure_eq("Zip pads shorter second range", zipped["type"], QString());
+
+    QStringList collected;
+    util::from(std::move(names)).forEach([&collected](QString const &s) {
+            collected.push_back(s.toUpper());
+        });
+    ensure_eq("Temporary container is owned", collected.join(","), QString("SRC,DST,TYPE"));
+
+    // lazy pipeline does not create intermediate containers
+    QList<Tracked> items;
+    for (int i = 0; i < 10000; ++i)
+        items.push_back(Tracked(i));
+    auto inc = [](Tracked const &t) { return Tracked(t.value + 1); };
+    auto is_odd = [](Tracked const &t) { return t.value % 2 != 0; };
+
+    QList<Tracked> eager_res, lazy_res;
+    Tracked::peak = Tracked::live;
+    do {
+        auto eager = util::map<Tracked>(inc, util::map<Tracked>(inc, items));
+        for (auto const &t : eager)
+            if (is_odd(t))
+                eager_res.push_back(t);
+    } while (0);
+    auto eager_peak = Tracked::peak - items.size();
+
+    Tracked::peak = Tracked::live;
+    lazy_res = util::from(items).map(inc).map(inc).filter(is_odd).toList();
+    auto lazy_peak = Tracked::peak - items.size() - eager_res.size();
+
+    ensure_eq("Same result size", lazy_res.size(), eager_res.size());
+    ensure_eq("Same first item", lazy_res[0].value, eager_res[0].value);
+    // eager: 2 intermediate lists + result, lazy: result + few temporaries
+    ensure_ge("Eager pipeline peak", eager_peak, 2 * items.size());
+    ensure("Lazy pipeline does not materialize intermediate lists"
+           , lazy_peak <= lazy_res.size() + 10);
+}
+
+template<> template<>
+void object::test<tid_visit_transform>()
+{
+    // deep tree is visited without recursion
+    int const depth = 5000;
+    QVariant deep(0);
+    for (int i = 1; i <= depth; ++i)
+        deep = QVariantList({i, deep});
+    int count = 0, max_level = 0;
+    util::visit([&count, &max_level](QVariant const &ctx, QVariant const &
+                                     , QVariant const &) {
+            ++count;
+            auto level = ctx.toInt() + 1;
+            max_level = std::max(max_level, level);
+            return level;
+        }, deep, 0);
+    ensure_eq("All nodes visited", count, 2 * depth + 1);
+    ensure_eq("Depth", max_level, depth + 1);
+
+    QVariantMap src = {
+        {"user", map({{"name", "u"}, {"password", "p1"}})}
+        , {"servers", list({map({{"host", "a"}, {"password", "p2"}})
+                            , map({{"host", "b"}})})}
+        , {"untouched", map({{"x", 1}, {"y", map({{"z", 2}})}})}
+    };
+    auto hide = [](QVariant const &key, QVariant const &, QVariant &res) {
+        if (str(key) != "password")
+            return false;
+        res = "***";
+        return true;
+    };
+    auto res = util::transform(hide, src).toMap();
+    ensure_eq("Replaced in map", get(res, "user", "password"), QVariant("***"));
+    ensure_eq("Other values are kept", get(res, "user", "name"), QVariant("u"));
+    auto servers = res["servers"].toList();
+    ensure_eq("Replaced in list", get(servers[0].toMap(), "password")
+              , QVariant("***"));
+    ensure_eq("List item is kept", get(servers[1].toMap(), "host"), QVariant("b"));
+    ensure_eq("Source is not changed", get(src, "user", "password")
+              , QVariant("p1"));
+    auto const &src_untouched = src["untouched"].toMap();
+    auto const &res_untouched = res["untouched"].toMap();
+    ensure("Unmodified branch is shared"
+           , &*src_untouched.constBegin() == &*res_untouched.constBegin());
+    ensure_eq("Not modified", util::transform([](QVariant const &, QVariant const &
+                                                 , QVariant &) { return false; }
+                                             , src).toMap(), src);
+    ensure_eq("Root is replaced", util::transform
+              ([](QVariant const &, QVariant const &, QVariant &res) {
+                  res = 1;
+                  return true;
+              }, src), QVariant(1));
+
+    // parallel visit visits the same nodes
+    QVariantMap big;
+    for (int i = 0; i < 100; ++i) {
+        QVariantList items;
+        for (int j = 0; j < 100; ++j)
+            items.push_back(map({{"id", i * 100 + j}}));
+        big.insert(QString::number(i), items);
+    }
+    auto collect = [](QStringList &dst, std::mutex &mutex) {
+        return [&dst, &mutex](QVariant const &ctx, QVariant const &key
+                              , QVariant const &) {
+            auto path = str(ctx) + "/" + str(key);
+            std::lock_guard<std::mutex> l(mutex);
+            dst.push_back(path);
+            return QVariant(path);
+        };
+    };
+    std::mutex mutex;
+    QStringList seq, par;
+    util::visit(collect(seq, mutex), big, "");
+    util::visit_parallel(collect(par, mutex), big, "");
+    seq.sort();
+    par.sort();
+    ensure_eq("Parallel visit count", par.size(), 1 + 100 + 100 * 100 * 2);
+    ensure_eq("Parallel visit", par, seq);
+}
+
+template<> template<>
+void object::test<tid_str>()
+{
+    ensure_eq("Single QString", str(QString("a")), QString("a"));
+    ensure_eq("Single long", str(-12345678901ll), QString("-12345678901"));
+    ensure_eq("Single double", str(1.5), QString("1.5"));
+    ensure_eq("Single Latin1", str(QLatin1String("l1")), QString("l1"));
+
+    QString s("s");
+    QByteArray b("b");
+    QVariant v(42);
+    ensure_eq("2 args", str("a", 1), QString("a1"));
+    ensure_eq("5 args", str(s, b, v, QLatin1String("l"), QChar('c'))
+              , QString("sb42lc"));
+    ensure_eq("10 args", str(0, -1, 2u, 3l, 4ull, 0.25, "x", s, b, v)
+              , QString("0-1234") + QString::number(0.25) + "xsb42");
+    ensure_eq("Integer limits"
+              , str(std::numeric_limits<long long>::min(), ","
+                    , std::numeric_limits<unsigned long long>::max())
+              , QString("-9223372036854775808,18446744073709551615"));
+    ensure_eq("UTF-8", str("\xd0\xb0", QByteArray("\xd0\xb1"), 1)
+              , QString::fromUtf8("\xd0\xb0\xd0\xb1") + "1");
+    ensure_eq("Empty pieces", str("", QString(), QByteArray()), QString(""));
+
+    // the same as pairwise concatenation, it is compared by benchmarks
+    for (int i = -50; i < 50; ++i) {
+        ensure_eq("2 args as pairwise", str(s, i), s + QString::number(i));
+        ensure_eq("5 args as pairwise", str(s, i, "/", b, i)
+                  , s + QString::number(i) + QString("/")
+                  + QString::fromUtf8(b) + QString::number(i));
+    }
+}
+
+namespace {
+
+/// result or error information
+template <typename FnT>
+QVariant bytesResult(FnT fn)
+{
+    try {
+        return fn();
+    } catch (error::Error const &e) {
+        return e.m;
+    }
+}
+
+}
+
+template<> template<>
+void object::test<tid_bytes_fuzz>()
+{
+    ensure_eq("Format bytes", util::formatBytes(100), QString("100"));
+    ensure_eq("Format zero", util::formatBytes(0), QString("0"));
+    ensure_eq("Format K", util::formatBytes(1024), QString("1K"));
+    ensure_eq("Format fraction", util::formatBytes(1536), QString("1.5K"));
+    ensure_eq("Format M", util::formatBytes(10 * 1024 * 1024), QString("10M"));
+    ensure_eq("Rounded to the next unit", util::formatBytes(1023.99)
+              , QString("1K"));
+    ensure_eq("Precision", util::formatBytes(1000 + 1000 / 3., "b", 1000, 3)
+              , QString("1.333K"));
+    ensure_eq("Source unit", util::formatBytes(2048, "kb"), QString("2G"));
+    ensure_throws<error::Error>("Negative", &util::formatBytes, -1, "b", 1024, 1);
+
+    std::mt19937 rnd(20141019);
+    auto pick = [&rnd](char const *chars) {
+        std::uniform_int_distribution<size_t> dist(0, strlen(chars) - 1);
+        return QChar(chars[dist(rnd)]);
+    };
+    auto random_string = [&rnd, &pick](char const *chars, int max_len) {
+        QString res;
+        auto len = std::uniform_int_distribution<int>(0, max_len)(rnd);
+        for (int i = 0; i < len; ++i)
+            res += pick(chars);
+        return res;
+    };
+    QStringList const units = {"b", "B", "k", "kb", "KiB", "mb", "GB", " g "
+                               , "ib", "x", "kk"};
+    for (int i = 0; i < 20000; ++i) {
+        auto value = str(random_string(" ", 1), random_string("0123456789.,", 6)
+                         , random_string(" kKmMgGyYiIbBx\t", 4));
+        auto unit = units[std::uniform_int_distribution<int>
+                          (0, units.size() - 1)(rnd)];
+        auto res = bytesResult([&value, &unit]() {
+                return util::parseBytes(value, unit, 1024);
+            });
+        auto expected = bytesResult([&value, &unit]() {
+                return parseBytesRef(value, unit, 1024);
+            });
+        ensure_eq(S_("Parsed", value, unit), res, expected);
+    }
+
+    for (int i = 0; i < 1000; ++i) {
+        auto value = std::uniform_real_distribution<double>(0, 1e15)(rnd);
+        auto parsed = util::parseBytes(util::formatBytes(value, "b", 1024, 3));
+        ensure(S_("Format and parse", util::formatBytes(value))
+               , std::abs(parsed - value) <= value * 1e-3);
+    }
+
+    // typical values, parsing speed is measured by benchmarks
+    QStringList lines = {"12345K", " 40 kb ", "1.5G", "1024", "7.25Mib"};
+    for (auto const &line : lines)
+        ensure_eq(S_("Parsed", line), util::parseBytes(line, "K", 1024)
+                  , parseBytesRef(line, "K", 1024));
+}
+
 }
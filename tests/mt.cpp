@@ -1,9 +1,32 @@
 #include <qtaround/mt.hpp>
+#include <qtaround/executor.hpp>
+#include <qtaround/coro.hpp>
+#include <qtaround/channel.hpp>
+#include <qtaround/debug.hpp>
+#include <qtaround/shm.hpp>
+#include <qtaround/subprocess.hpp>
 #include <tut/tut.hpp>
 #include "tests_common.hpp"
 #include <mutex>
 #include <condition_variable>
 #include <QFile>
+#include <QPointer>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QTimer>
+#include <thread>
+#include <vector>
+#include <set>
+#include <map>
+#include <future>
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 namespace tut
 {
@@ -21,6 +44,23 @@ tf vault_mt_test("mt");
 
 enum test_ids {
     tid_actor =  1
+    , tid_mailbox
+    , tid_ask
+    , tid_pool
+    , tid_executor
+    , tid_backpressure
+    , tid_batch
+    , tid_metrics
+    , tid_shutdown
+    , tid_coroutines
+    , tid_timers
+    , tid_group
+    , tid_channel
+    , tid_graph
+    , tid_thread_options
+    , tid_shm
+    , tid_future
+    , tid_undelivered
 };
 
 class Test;
@@ -132,6 +172,1473 @@ void object::test<tid_actor>()
     ensure_eq("Creation and processing threads should be the same", testObjThread, eventThread);
 }
 
+
+template<> template<>
+void object::test<tid_mailbox>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+    auto actor = mt::startActorSync<Test>(make_test);
+    ensure("Actor should be here", !!actor);
+
+    static const int producers_count = 4;
+    static const int messages_count = 10000;
+    std::mutex mutex;
+    std::condition_variable cond;
+    // accessed only from the actor thread until all messages are received
+    std::vector<int> last(producers_count, -1);
+    int received = 0;
+    int out_of_order = 0;
+    int wrong_thread = 0;
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < producers_count; ++p) {
+        producers.emplace_back([&, p]() {
+                for (int i = 0; i < messages_count; ++i) {
+                    actor->post<Test>([&, p, i](Test *test) {
+                            if (test->creation_thread != QThread::currentThread())
+                                ++wrong_thread;
+                            if (last[p] + 1 != i)
+                                ++out_of_order;
+                            last[p] = i;
+                            if (++received == producers_count * messages_count) {
+                                std::unique_lock<std::mutex> l(mutex);
+                                cond.notify_all();
+                            }
+                        });
+                }
+            });
+    }
+    for (auto &t : producers)
+        t.join();
+
+    auto all_received = false;
+    do {
+        std::unique_lock<std::mutex> l(mutex);
+        all_received = cond.wait_for
+            (l, std::chrono::seconds(10), [&]() {
+                return received == producers_count * messages_count;
+            });
+    } while (0);
+    ensure("All messages should be delivered", all_received);
+    ensure_eq("Messages from one producer should be ordered", out_of_order, 0);
+    ensure_eq("Messages should be delivered in the actor thread", wrong_thread, 0);
+
+    // events are passed through the same mailbox
+    QThread *eventThread = nullptr;
+    ensure("Should post events", actor->postEvent(new Event([&](Test *) {
+                    std::unique_lock<std::mutex> l(mutex);
+                    eventThread = QThread::currentThread();
+                    cond.notify_all();
+                })));
+    do {
+        std::unique_lock<std::mutex> l(mutex);
+        cond.wait_for(l, std::chrono::seconds(2)
+                      , [&eventThread]() { return eventThread; });
+    } while (0);
+    ensure("Event should be delivered", eventThread != nullptr);
+    ensure("Actor should quit", actor->quitSync(5000));
+    ensure("Should not post messages"
+           , !actor->post<Test>([](Test *) {}));
+}
+
+
+template<> template<>
+void object::test<tid_ask>()
+{
+    namespace mt = qtaround::mt;
+    auto main_thread = QThread::currentThread();
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+    auto actor = mt::startActorSync<Test>(make_test);
+    ensure("Actor should be here", !!actor);
+
+    std::vector<mt::Future<int> > requests;
+    for (int i = 0; i < 100; ++i) {
+        requests.push_back(actor->ask<Test>([i, main_thread](Test *test) {
+                    if (test->creation_thread != QThread::currentThread()
+                        || QThread::currentThread() == main_thread)
+                        throw std::logic_error("Wrong thread");
+                    return i * 2;
+                }));
+    }
+    auto all = mt::when_all(requests);
+    ensure("Requests should be processed", all.waitFor(5000));
+    auto results = all.get();
+    ensure_eq("Wrong results count", results.size(), requests.size());
+    for (int i = 0; i < (int)results.size(); ++i)
+        ensure_eq("Wrong result", results[i], i * 2);
+
+    auto failed = actor->ask<Test>([](Test *) -> int {
+            throw std::runtime_error("Request failed");
+        });
+    auto failed_all = mt::when_all(std::vector<mt::Future<int> >{
+            actor->ask<Test>([](Test *) { return 1; }), failed });
+    ensure("Failed request should be ready", failed_all.waitFor(5000));
+    auto is_thrown = false;
+    try {
+        failed.get();
+    } catch (std::runtime_error const &) {
+        is_thrown = true;
+    }
+    ensure("Request error should be passed to the caller", is_thrown);
+    ensure_throws<std::runtime_error>
+        ("when_all should fail", [&failed_all]() { failed_all.get(); });
+
+    // continuation is executed in the caller thread
+    QObject context;
+    QThread *continuation_thread = nullptr;
+    auto next = actor->ask<Test>([](Test *) { return 42; })
+        .then(&context, [&continuation_thread](mt::Future<int> f) {
+                continuation_thread = QThread::currentThread();
+                return f.get() + 1;
+            });
+    QElapsedTimer timer;
+    timer.start();
+    while (!next.isReady() && timer.elapsed() < 5000)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+    ensure("Continuation should be executed", next.isReady());
+    ensure_eq("Wrong continuation result", next.get(), 43);
+    ensure_eq("Continuation should be executed in the caller thread"
+              , continuation_thread, main_thread);
+
+    ensure("Actor should quit", actor->quitSync(5000));
+    auto late = actor->ask<Test>([](Test *) { return 1; });
+    ensure("Request to the stopped actor should fail", late.isReady());
+    ensure_throws<qtaround::error::Error>
+        ("Stopped actor", [&late]() { late.get(); });
+}
+
+
+template<> template<>
+void object::test<tid_pool>()
+{
+    namespace mt = qtaround::mt;
+    auto main_thread = QThread::currentThread();
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+    static const int actors_count = 200;
+    static const int messages_count = 100;
+
+    std::vector<mt::ActorHandle> actors;
+    for (int i = 0; i < actors_count; ++i) {
+        auto actor = mt::startActorSync<Test>
+            (make_test, nullptr, {{"pool", true}});
+        ensure("Pooled actor should be here", !!actor);
+        actors.push_back(actor);
+    }
+
+    // each actor checks order of its messages, there is no
+    // synchronization inside the handler because only one worker
+    // executes actor mailbox at a time
+    std::vector<std::shared_ptr<std::vector<int> > > received;
+    std::vector<mt::Future<QThread*> > threads;
+    for (auto &actor : actors) {
+        auto data = std::make_shared<std::vector<int> >();
+        received.push_back(data);
+        for (int i = 0; i < messages_count; ++i)
+            actor->post<Test>([data, i](Test *) { data->push_back(i); });
+        threads.push_back(actor->ask<Test>([](Test *) {
+                    return QThread::currentThread();
+                }));
+    }
+    auto all = mt::when_all(threads);
+    ensure("Requests should be processed", all.waitFor(10000));
+
+    std::set<QThread*> used_threads;
+    for (auto t : all.get()) {
+        ensure_ne("Pool thread is expected", t, main_thread);
+        used_threads.insert(t);
+    }
+    ensure("Thread count should not depend on actor count"
+           , used_threads.size() <= mt::Executor::global().size());
+
+    for (auto &data : received) {
+        ensure_eq("All messages should be received", data->size()
+                  , (size_t)messages_count);
+        for (int i = 0; i < messages_count; ++i)
+            ensure_eq("Messages should be ordered", (*data)[i], i);
+    }
+
+    auto finished_count = std::make_shared<std::atomic<int> >(0);
+    for (auto &actor : actors)
+        QObject::connect(actor.get(), &mt::Actor::finished
+                         , [finished_count]() { ++*finished_count; });
+    for (auto &actor : actors)
+        actor->quit();
+    for (auto &actor : actors)
+        ensure("Pooled actor should quit", actor->quitSync(5000));
+    ensure_eq("All actors should finish", finished_count->load(), actors_count);
+    ensure("Should not post messages to finished actor"
+           , !actors[0]->post<Test>([](Test *) {}));
+
+    // object is deleted on finish, deferred deletions of the thread
+    // running the mailbox are not touched
+    auto is_deleted = std::make_shared<std::atomic<bool> >(false);
+    auto actor = mt::startActorSync<Test>([is_deleted]() {
+            auto obj = make_qobject_unique<Test>();
+            QObject::connect(obj.get(), &QObject::destroyed
+                             , [is_deleted]() { *is_deleted = true; });
+            return obj;
+        }, nullptr, {{"pool", true}});
+    QPointer<QObject> deferred(new QObject());
+    deferred->deleteLater();
+    ensure("Pooled actor should quit", actor->quitSync(5000));
+    ensure("Pooled object is deleted", is_deleted->load());
+    ensure("Deferred deletion is not flushed", !deferred.isNull());
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+}
+
+
+namespace {
+
+long fib(qtaround::mt::Executor &executor, int n)
+{
+    if (n < 10)
+        return n < 2 ? n : fib(executor, n - 1) + fib(executor, n - 2);
+    long a = 0, b = 0;
+    qtaround::mt::TaskGroup group(executor);
+    group.run([&]() { a = fib(executor, n - 1); });
+    group.run([&]() { b = fib(executor, n - 2); });
+    group.wait();
+    return a + b;
+}
+
+}
+
+template<> template<>
+void object::test<tid_executor>()
+{
+    namespace mt = qtaround::mt;
+    mt::Executor executor({{"threads", 3}});
+    ensure_eq("Wrong pool size", executor.size(), (size_t)3);
+
+    std::vector<mt::Future<int> > results;
+    for (int i = 0; i < 1000; ++i)
+        results.push_back(executor.submit([i]() { return i * i; }));
+    auto all = mt::when_all(results);
+    ensure("Tasks should be executed", all.waitFor(10000));
+    auto values = all.get();
+    for (int i = 0; i < (int)values.size(); ++i)
+        ensure_eq("Wrong task result", values[i], i * i);
+
+    auto failed = executor.submit([]() -> int {
+            throw std::runtime_error("Task failed");
+        });
+    ensure_throws<std::runtime_error>
+        ("Task error should be passed", [&failed]() { failed.get(); });
+
+    std::vector<std::atomic<int> > visited(10007);
+    for (auto &v : visited)
+        v = 0;
+    executor.parallel_for(0, visited.size(), [&visited](size_t i) {
+            ++visited[i];
+        });
+    for (size_t i = 0; i < visited.size(); ++i)
+        ensure_eq("Each index should be processed once", visited[i].load(), 1);
+
+    ensure_throws<std::runtime_error>
+        ("parallel_for should rethrow", [&executor]() {
+            executor.parallel_for(0, 100, [](size_t i) {
+                    if (i == 42)
+                        throw std::runtime_error("Iteration failed");
+                });
+        });
+
+    // nested groups are waited from workers, should not deadlock
+    auto nested = executor.submit([&executor]() { return fib(executor, 20); });
+    ensure("Nested groups should be finished", nested.waitFor(20000));
+    ensure_eq("Wrong fib", nested.get(), 6765L);
+
+    // thread joining the group executes only tasks of this group, not
+    // mailboxes of pooled actors queued to the same executor
+    auto main_thread = QThread::currentThread();
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+    auto actor = mt::startActorSync<Test>(make_test, nullptr, {{"pool", true}});
+    ensure("Pooled actor should be here", !!actor);
+    auto in_main_thread = std::make_shared<std::atomic<int> >(0);
+    for (int i = 0; i < 100; ++i) {
+        actor->post<Test>([in_main_thread, main_thread](Test *) {
+                if (QThread::currentThread() == main_thread)
+                    ++*in_main_thread;
+            });
+        mt::Executor::global().parallel_for(0, 64, [](size_t) {});
+    }
+    ensure("Actor should quit", actor->quitSync(5000));
+    ensure_eq("Actor should not be executed by joining thread"
+              , in_main_thread->load(), 0);
+}
+
+
+namespace {
+
+/// blocks actor until opened
+class Gate
+{
+public:
+    Gate() : opened_(opened_promise_.get_future().share()) {}
+
+    void close(qtaround::mt::ActorHandle const &actor)
+    {
+        std::promise<void> entered;
+        auto is_entered = entered.get_future();
+        auto opened = opened_;
+        auto p = std::make_shared<std::promise<void> >(std::move(entered));
+        actor->post<Test>([p, opened](Test *) {
+                p->set_value();
+                opened.wait();
+            });
+        is_entered.wait();
+    }
+
+    void open() { opened_promise_.set_value(); }
+
+private:
+    std::promise<void> opened_promise_;
+    std::shared_future<void> opened_;
+};
+
+/// request can be rejected while full mailbox is processed, so retry
+bool isProcessed(qtaround::mt::ActorHandle const &actor)
+{
+    for (int i = 0; i < 500; ++i) {
+        auto res = actor->ask<Test>([](Test *) { return true; });
+        if (!res.waitFor(5000))
+            return false;
+        try {
+            return res.get();
+        } catch (qtaround::error::Error const &) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+}
+
+template<> template<>
+void object::test<tid_backpressure>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+
+    for (auto pool : {false, true}) {
+        auto mode = pool ? "pool" : "thread";
+        auto actor = mt::startActorSync<Test>
+            (make_test, nullptr, {{"pool", pool}, {"capacity", 10}
+                    , {"overflow", "fail"}});
+        std::atomic<int> high(0), low(0);
+        QObject::connect(actor.get(), &mt::Actor::highWater
+                         , [&high]() { ++high; });
+        QObject::connect(actor.get(), &mt::Actor::lowWater
+                         , [&low]() { ++low; });
+        Gate gate;
+        gate.close(actor);
+        for (int i = 0; i < 10; ++i)
+            ensure(S_(mode, "Should post up to capacity")
+                   , actor->post<Test>([](Test *) {}));
+        ensure(S_(mode, "Should fail if mailbox is full")
+               , !actor->post<Test>([](Test *) {}));
+        ensure_eq(S_(mode, "High water should be reached"), high.load(), 1);
+        gate.open();
+        ensure(S_(mode, "Messages should be processed"), isProcessed(actor));
+        ensure_eq(S_(mode, "Low water should be reached"), low.load(), 1);
+    }
+
+    auto actor = mt::startActorSync<Test>
+        (make_test, nullptr, {{"capacity", 10}, {"overflow", "drop_oldest"}});
+    auto received = std::make_shared<std::vector<int> >();
+    do {
+        Gate gate;
+        gate.close(actor);
+        for (int i = 0; i < 20; ++i)
+            ensure("Should post dropping oldest"
+                   , actor->post<Test>([i, received](Test *) {
+                           received->push_back(i);
+                       }));
+        gate.open();
+    } while (0);
+    ensure("Messages should be processed", isProcessed(actor));
+    ensure_eq("Only the newest messages should be left", received->size(), (size_t)10);
+    for (int i = 0; i < 10; ++i)
+        ensure_eq("Wrong message left", (*received)[i], i + 10);
+
+    actor = mt::startActorSync<Test>
+        (make_test, nullptr, {{"capacity", 10}, {"overflow", "block"}});
+    do {
+        Gate gate;
+        gate.close(actor);
+        for (int i = 0; i < 10; ++i)
+            actor->post<Test>([](Test *) {});
+        std::atomic<bool> is_posted(false);
+        std::thread producer([&]() {
+                is_posted = actor->post<Test>([](Test *) {});
+            });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        ensure("Producer should be blocked", !is_posted);
+        gate.open();
+        producer.join();
+        ensure("Producer should be unblocked", is_posted);
+    } while (0);
+    ensure("Messages should be processed", isProcessed(actor));
+
+    // there are more blocked producers than the mailbox can hold
+    static const int producers_count = 8;
+    actor = mt::startActorSync<Test>
+        (make_test, nullptr, {{"capacity", 2}, {"overflow", "block"}});
+    auto delivered = std::make_shared<std::atomic<int> >(0);
+    do {
+        Gate gate;
+        gate.close(actor);
+        for (int i = 0; i < 2; ++i)
+            actor->post<Test>([delivered](Test *) { ++*delivered; });
+        std::atomic<int> posted(0);
+        std::vector<std::thread> producers;
+        for (int i = 0; i < producers_count; ++i)
+            producers.emplace_back([&actor, &posted, delivered]() {
+                    if (actor->post<Test>([delivered](Test *) { ++*delivered; }))
+                        ++posted;
+                });
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        ensure_eq("Producers should be blocked", posted.load(), 0);
+        gate.open();
+        for (auto &producer : producers)
+            producer.join();
+        ensure_eq("All producers should be unblocked", posted.load()
+                  , producers_count);
+    } while (0);
+    ensure("Messages should be processed", isProcessed(actor));
+    ensure_eq("All messages should be delivered", delivered->load()
+              , producers_count + 2);
+
+    // quit request is not dropped by the following messages
+    actor = mt::startActorSync<Test>
+        (make_test, nullptr, {{"pool", true}, {"capacity", 2}
+                , {"overflow", "drop_oldest"}});
+    auto is_finished = std::make_shared<std::atomic<bool> >(false);
+    QObject::connect(actor.get(), &mt::Actor::finished
+                     , [is_finished]() { *is_finished = true; });
+    do {
+        Gate gate;
+        gate.close(actor);
+        actor->quit();
+        for (int i = 0; i < 10; ++i)
+            actor->post<Test>([](Test *) {});
+        gate.open();
+    } while (0);
+    for (int i = 0; i < 500 && !*is_finished; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ensure("Actor should quit", is_finished->load());
+
+    ensure_throws<qtaround::error::Error>
+        ("Wrong overflow policy", [&make_test]() {
+            mt::startActorSync<Test>
+                (make_test, nullptr, {{"capacity", 1}, {"overflow", "wait"}});
+        });
+}
+
+
+namespace {
+
+class BatchTest : public Test, public qtaround::mt::BatchHandler
+{
+public:
+    void handleBatch(qtaround::mt::Message * const *messages, size_t count)
+    {
+        batch_sizes.push_back(count);
+        for (size_t i = 0; i < count; ++i)
+            messages[i]->deliver(this);
+    }
+
+    std::vector<size_t> batch_sizes;
+};
+
+}
+
+template<> template<>
+void object::test<tid_batch>()
+{
+    namespace mt = qtaround::mt;
+    static const size_t batch_size = 16;
+
+    for (auto pool : {false, true}) {
+        auto mode = pool ? "pool" : "thread";
+        auto make_test = []() { return make_qobject_unique<BatchTest>(); };
+        auto actor = mt::startActorSync<BatchTest>
+            (make_test, nullptr, {{"pool", pool}, {"batch", (uint)batch_size}});
+        ensure(S_(mode, "Actor should be here"), !!actor);
+
+        auto keyed = std::make_shared<std::vector<int> >();
+        auto plain = std::make_shared<std::vector<int> >();
+        do {
+            Gate gate;
+            gate.close(actor);
+            for (int i = 0; i < 100; ++i) {
+                if (i % 2)
+                    actor->post<Test>([i, plain](Test *) {
+                            plain->push_back(i);
+                        });
+                else
+                    actor->post<Test>("state", [i, keyed](Test *) {
+                            keyed->push_back(i);
+                        });
+            }
+            gate.open();
+        } while (0);
+        auto sizes = actor->ask<BatchTest>([](BatchTest *obj) {
+                return obj->batch_sizes;
+            });
+        ensure(S_(mode, "Batches should be processed"), sizes.waitFor(5000));
+
+        size_t total = 0;
+        for (auto n : sizes.get()) {
+            ensure(S_(mode, "Batch is too large"), n <= batch_size);
+            total += n;
+        }
+        ensure_eq(S_(mode, "All plain messages should be delivered")
+                  , plain->size(), (size_t)50);
+        for (int i = 0; i < 50; ++i)
+            ensure_eq(S_(mode, "Plain messages should be ordered")
+                      , (*plain)[i], i * 2 + 1);
+        ensure(S_(mode, "Keyed messages should be coalesced")
+               , keyed->size() < 50);
+        ensure_eq(S_(mode, "The newest keyed message should be delivered")
+                  , keyed->back(), 98);
+        ensure(S_(mode, "Handler should get coalesced batches")
+               , total < 102);
+    }
+}
+
+
+template<> template<>
+void object::test<tid_metrics>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+
+    auto actor = mt::startActorSync<Test>(make_test);
+    auto info = actor->metrics();
+    ensure_eq("Depth is always available", info["depth"].toInt(), 0);
+    ensure("Histograms only if turned on", !info.contains("latency_us"));
+
+    for (auto pool : {false, true}) {
+        auto mode = pool ? "pool" : "thread";
+        actor = mt::startActorSync<Test>
+            (make_test, nullptr, {{"pool", pool}, {"metrics", true}
+                    , {"capacity", 20}, {"overflow", "fail"}});
+        do {
+            Gate gate;
+            gate.close(actor);
+            for (int i = 0; i < 25; ++i)
+                actor->post<Test>([](Test *) {
+                        std::this_thread::sleep_for
+                            (std::chrono::microseconds(100));
+                    });
+            info = actor->metrics();
+            ensure_eq(S_(mode, "Wrong depth"), info["depth"].toInt(), 20);
+            ensure_eq(S_(mode, "Wrong rejected count")
+                      , info["rejected"].toInt(), 5);
+            gate.open();
+        } while (0);
+        ensure(S_(mode, "Should be processed"), isProcessed(actor));
+
+        info = actor->metrics();
+        ensure_eq(S_(mode, "Wrong depth after processing")
+                  , info["depth"].toInt(), 0);
+        ensure(S_(mode, "Peak depth"), info["peak_depth"].toInt() >= 19);
+        ensure(S_(mode, "Processed count")
+               , info["processed"].toInt() >= 21);
+        auto latency = info["latency_us"].toMap();
+        ensure(S_(mode, "Latency count"), latency["count"].toInt() >= 21);
+        ensure(S_(mode, "Gate latency"), latency["max"].toULongLong() > 0);
+        auto run_time = info["run_time_us"].toMap();
+        ensure(S_(mode, "Run time p50"), run_time["p50"].toULongLong() >= 63);
+        auto busy = info["busy"].toDouble();
+        ensure(S_(mode, "Busy share"), busy > 0 && busy <= 1);
+    }
+}
+
+
+template<> template<>
+void object::test<tid_shutdown>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+    auto app = QCoreApplication::instance();
+    ensure("Application is needed", app);
+
+    auto start_busy = [&make_test](int count, int busy_ms) {
+        std::vector<mt::ActorHandle> actors;
+        for (int i = 0; i < count; ++i) {
+            auto actor = mt::startActorSync<Test>(make_test);
+            actor->post<Test>([busy_ms](Test *) {
+                    std::this_thread::sleep_for
+                        (std::chrono::milliseconds(busy_ms));
+                });
+            mt::deleteOnApplicationExit(actor);
+            actors.push_back(actor);
+        }
+        return actors;
+    };
+    auto run_app = [app]() {
+        QElapsedTimer timer;
+        timer.start();
+        QTimer::singleShot(0, app, SLOT(quit()));
+        app->exec();
+        return timer.elapsed();
+    };
+
+    // actors are waited in parallel
+    auto actors = start_busy(5, 500);
+    auto elapsed = run_app();
+    for (auto &actor : actors)
+        ensure("Actor should be finished", actor->quitSync(0));
+    ensure("Actors should be waited in parallel", elapsed < 2000);
+    actors.clear();
+
+    // actors missed the deadline are not waited by destructors
+    mt::setShutdownTimeout(200);
+    actors = start_busy(3, 2000);
+    elapsed = run_app();
+    ensure("Shutdown should be bounded by deadline", elapsed < 1500);
+    QElapsedTimer timer;
+    timer.start();
+    actors.clear();
+    ensure("Destruction should not wait", timer.elapsed() < 1000);
+    mt::setShutdownTimeout(5000);
+}
+
+
+#if defined(QTAROUND_TEST_COROUTINES) && !defined(QTAROUND_HAS_COROUTINES)
+#error Coroutines are requested but not available
+#endif
+
+#ifdef QTAROUND_HAS_COROUTINES
+
+namespace {
+
+struct CoroResult
+{
+    int value;
+    QByteArray output;
+    bool isSameThread;
+};
+
+/// subprocess is controlled by the event loop, pool workers have no one
+qtaround::mt::Future<CoroResult> workflow
+(qtaround::mt::ActorHandle other, bool has_event_loop)
+{
+    namespace mt = qtaround::mt;
+    namespace subprocess = qtaround::subprocess;
+    auto thread = QThread::currentThread();
+    CoroResult res{0, QByteArray(), true};
+
+    res.value = co_await other->ask<Test>([](Test *) { return 21; });
+    res.isSameThread = res.isSameThread && thread == QThread::currentThread();
+
+    co_await mt::after(10);
+    res.isSameThread = res.isSameThread && thread == QThread::currentThread();
+
+    if (has_event_loop) {
+        QStringList args{"-c", "echo $((2*21))"};
+        auto ps = co_await subprocess::run_async("sh", args);
+        res.isSameThread = res.isSameThread
+            && thread == QThread::currentThread();
+        res.output = ps.stdout;
+    }
+    co_return res;
+}
+
+}
+
+template<> template<>
+void object::test<tid_coroutines>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+    for (auto pool : {false, true}) {
+        auto mode = pool ? "pool" : "thread";
+        auto actor = mt::startActorSync<Test>
+            (make_test, nullptr, {{"pool", pool}});
+        auto other = mt::startActorSync<Test>(make_test);
+
+        auto started = actor->ask<Test>([other, pool](Test *) {
+                return workflow(other, !pool);
+            });
+        ensure(S_(mode, "Coroutine should start"), started.waitFor(5000));
+        auto res = started.get();
+        QElapsedTimer timer;
+        timer.start();
+        while (!res.isReady() && timer.elapsed() < 10000)
+            QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+        ensure(S_(mode, "Coroutine should finish"), res.isReady());
+        ensure_eq(S_(mode, "Wrong ask result"), res.get().value, 21);
+        if (!pool) {
+            ensure_eq(S_(mode, "Wrong subprocess output")
+                      , QString(res.get().output), QString("42\n"));
+            ensure(S_(mode, "Should be resumed in the actor thread")
+                   , res.get().isSameThread);
+        }
+    }
+
+    // coroutine can't be resumed by the finished actor, it is
+    // destroyed and its future is failed
+    auto actor = mt::startActorSync<Test>(make_test, nullptr, {{"pool", true}});
+    mt::Promise<int> p;
+    auto started = actor->ask<Test>([p](Test *) {
+            return [](mt::Future<int> f) -> mt::Future<int> {
+                co_return co_await f;
+            }(p.future());
+        });
+    ensure("Coroutine should start", started.waitFor(5000));
+    auto res = started.get();
+    ensure("Actor should quit", actor->quitSync(5000));
+    p.setValue(1);
+    ensure("Coroutine should be destroyed", res.isReady());
+    ensure_throws<qtaround::error::Error>
+        ("Coroutine future should be failed", [&res]() { res.get(); });
+
+    // there is no context to resume coroutine in the thread w/o actor
+    // and event loop, it is not resumed by the timer thread
+    auto no_context = std::async(std::launch::async, []() {
+            return [](mt::Future<void> f) -> mt::Future<void> {
+                co_await f;
+            }(mt::after(10));
+        }).get();
+    ensure("Coroutine should not be suspended", no_context.isReady());
+    ensure_throws<qtaround::error::Error>
+        ("No context to resume", [&no_context]() { no_context.get(); });
+}
+
+#endif // QTAROUND_HAS_COROUTINES
+
+
+template<> template<>
+void object::test<tid_timers>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+    for (auto pool : {false, true}) {
+        auto mode = pool ? "pool" : "thread";
+        auto actor = mt::startActorSync<Test>
+            (make_test, nullptr, {{"pool", pool}});
+        std::mutex mutex;
+        std::condition_variable cond;
+        QElapsedTimer timer;
+        timer.start();
+
+        qint64 fired_at = -1;
+        std::atomic<int> canceled_count(0);
+        std::atomic<int> periodic_count(0);
+        auto delayed = actor->postDelayed<Test>(50, [&](Test *) {
+                std::lock_guard<std::mutex> l(mutex);
+                fired_at = timer.elapsed();
+                cond.notify_all();
+            });
+        ensure(S_(mode, "Timer id should be valid"), delayed != 0);
+        auto canceled = actor->postDelayed<Test>(30, [&](Test *) {
+                ++canceled_count;
+            });
+        ensure(S_(mode, "Should cancel timer"), actor->cancelTimer(canceled));
+        ensure(S_(mode, "Second cancel should fail")
+               , !actor->cancelTimer(canceled));
+        auto periodic = actor->postPeriodic<Test>(10, [&](Test *) {
+                ++periodic_count;
+            });
+        do {
+            std::unique_lock<std::mutex> l(mutex);
+            cond.wait_for(l, std::chrono::seconds(5)
+                          , [&fired_at]() { return fired_at >= 0; });
+        } while (0);
+        ensure(S_(mode, "Delayed message should be delivered"), fired_at >= 0);
+        ensure(S_(mode, "Delayed message is too early"), fired_at >= 50);
+        ensure(S_(mode, "Canceled timer should not fire")
+               , !canceled_count.load());
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ensure(S_(mode, "Cancel periodic timer"), actor->cancelTimer(periodic));
+        ensure(S_(mode, "Is periodic?"), periodic_count.load() >= 3);
+        ensure(S_(mode, "Wait for processing"), isProcessed(actor));
+        auto count = periodic_count.load();
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        ensure_eq(S_(mode, "Periodic timer should be stopped")
+                  , periodic_count.load(), count);
+    }
+
+    // many timers are cheap to create and cancel
+    auto actor = mt::startActorSync<Test>(make_test);
+    std::vector<quint64> ids;
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < 100000; ++i)
+        ids.push_back(actor->postDelayed<Test>(60000 + i, [](Test *) {}));
+    for (auto id : ids)
+        ensure("Should cancel", actor->cancelTimer(id));
+    ensure("Timers should be cheap", timer.elapsed() < 2000);
+
+    // long timer goes through upper levels
+    auto long_timer = mt::after(300);
+    ensure("Timer should not fire early", !long_timer.waitFor(250));
+    ensure("Timer should fire", long_timer.waitFor(2000));
+
+    auto canceled = mt::after(50);
+    canceled.cancel();
+    ensure("Canceled future is ready", canceled.isReady());
+
+    // upper level timer due before the level 0 one placed after the
+    // next cascade is not delayed until the latter. Cascade position
+    // is not known, so try a few
+    for (int i = 0; i < 4; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(60));
+        auto upper = mt::after(300);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        auto lower = mt::after(250);
+        ensure("Upper level timer should fire", upper.waitFor(2000));
+        ensure("Level 0 timer should not fire together", !lower.isReady());
+        ensure("Level 0 timer should fire", lower.waitFor(2000));
+    }
+
+    // full mailbox does not block the timer thread, timer message is
+    // dropped and periodic timer continues
+    auto full = mt::startActorSync<Test>
+        (make_test, nullptr, {{"capacity", 1}, {"overflow", "block"}});
+    std::atomic<int> full_count(0);
+    do {
+        Gate gate;
+        gate.close(full);
+        ensure("Should post up to capacity", full->post<Test>([](Test *) {}));
+        auto periodic = full->postPeriodic<Test>(10, [&full_count](Test *) {
+                ++full_count;
+            });
+        auto not_blocked = mt::after(100);
+        ensure("Timer thread should not be blocked", not_blocked.waitFor(2000));
+        ensure("Timer messages should be dropped"
+               , full->metrics()["dropped"].toInt() > 0);
+        gate.open();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        ensure("Cancel periodic timer", full->cancelTimer(periodic));
+    } while (0);
+    ensure("Wait for processing", isProcessed(full));
+    ensure("Periodic timer should continue", full_count.load() > 0);
+
+    // timer thread does not own the actor, it is released by the last
+    // handle owner
+    for (int i = 0; i < 20; ++i) {
+        auto actor = mt::startActorSync<Test>(make_test);
+        actor->postPeriodic<Test>(1, [](Test *) {});
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        std::weak_ptr<mt::Actor> weak = actor;
+        actor.reset();
+        ensure("Actor should be released by the handle owner", weak.expired());
+    }
+    QCoreApplication::sendPostedEvents(nullptr, QEvent::DeferredDelete);
+}
+
+
+template<> template<>
+void object::test<tid_group>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+    auto group_ptr = mt::startActorGroup<Test>(make_test, {{"size", 4}});
+    auto &group = *group_ptr;
+    ensure_eq("Group size", group.size(), 4u);
+
+    std::mutex mutex;
+    std::map<QString, std::vector<int> > seq;
+    std::map<QString, std::set<Test*> > handlers;
+    std::vector<mt::Future<void> > done;
+    int const keys = 16, count = 100;
+    for (int i = 0; i < count; ++i) {
+        for (int k = 0; k < keys; ++k) {
+            auto key = QString("key%1").arg(k);
+            ensure(S_("Post", key), group.post<Test>(key, [&, key, i](Test *t) {
+                        std::lock_guard<std::mutex> l(mutex);
+                        seq[key].push_back(i);
+                        handlers[key].insert(t);
+                    }));
+        }
+    }
+    for (size_t i = 0; i < group.size(); ++i)
+        done.push_back(group.shard(i)->ask<Test>([](Test *) {}));
+    mt::when_all(done).get();
+
+    ensure_eq("All keys processed", seq.size(), (size_t)keys);
+    for (auto const &kv : seq) {
+        ensure_eq(S_("Count for", kv.first), kv.second.size(), (size_t)count);
+        for (int i = 0; i < count; ++i)
+            ensure_eq(S_("Order for", kv.first), kv.second[i], i);
+        ensure_eq(S_("Single handler for", kv.first)
+                  , handlers[kv.first].size(), 1u);
+    }
+
+    auto stats = group.stats();
+    quint64 total = 0;
+    for (auto const &v : stats["shards"].toList())
+        total += v.toMap()["messages"].toULongLong();
+    ensure_eq("Messages routed", total, (quint64)(keys * count));
+
+    group.resetStats();
+    for (int i = 0; i < 100; ++i)
+        group.post<Test>("hot", [](Test *) {});
+    group.post<Test>("cold", [](Test *) {});
+    auto hot = group.hotShards();
+    ensure_eq("Single hot shard", hot.size(), 1u);
+    ensure_eq("Hot shard", hot[0], group.shardIndex("hot"));
+    ensure_eq("Hot shard is reported"
+              , group.stats()["hot"].toList().size(), 1);
+
+    ensure("Quit group", group.quitSync(5000));
+}
+
+
+template<> template<>
+void object::test<tid_channel>()
+{
+    namespace mt = qtaround::mt;
+
+    mt::Channel<int> c(3);
+    ensure_eq("Capacity is rounded up", c.capacity(), 4u);
+    for (int i = 0; i < 4; ++i)
+        ensure("Send", c.trySend(i));
+    ensure("Channel is full", !c.trySend(4));
+    ensure("Send timeout", !c.sendFor(4, 10));
+    ensure_eq("Size", c.size(), 4u);
+    int v = -1;
+    for (int i = 0; i < 4; ++i) {
+        ensure("Receive", c.tryReceive(v));
+        ensure_eq("FIFO order", v, i);
+    }
+    ensure("Channel is empty", !c.tryReceive(v));
+    ensure("Receive timeout", !c.receiveFor(v, 10));
+
+    // blocked sender is woken up by receiver
+    for (int i = 0; i < 4; ++i)
+        c.send(i);
+    auto sender = std::async(std::launch::async, [&c]() {
+            return c.send(100);
+        });
+    ensure("Sender should block"
+           , sender.wait_for(std::chrono::milliseconds(50))
+           != std::future_status::ready);
+    ensure("Receive from full", c.receive(v));
+    ensure("Sender should be woken up", sender.get());
+
+    // close: items are drained, then receive fails
+    c.close();
+    ensure("Send to closed", !c.trySend(5));
+    for (int i = 1; i < 4; ++i) {
+        ensure("Drain", c.receive(v));
+        ensure_eq("Drained", v, i);
+    }
+    ensure("Last item", c.receive(v));
+    ensure_eq("Last item value", v, 100);
+    ensure("Closed and empty", !c.receive(v));
+
+    // blocked receiver is woken up by close
+    mt::Channel<int> c2(2);
+    auto receiver = std::async(std::launch::async, [&c2]() {
+            int v;
+            return c2.receive(v);
+        });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    c2.close();
+    ensure("Receiver is woken up by close", !receiver.get());
+
+    // move-only items
+    mt::Channel<std::unique_ptr<int> > pc(2);
+    std::unique_ptr<int> p(new int(42));
+    ensure("Send unique_ptr", pc.send(std::move(p)));
+    ensure("Moved", !p);
+    std::unique_ptr<int> p2(new int(1));
+    pc.trySend(std::move(p2));
+    pc.trySend(std::unique_ptr<int>(new int(2)));
+    std::unique_ptr<int> p3(new int(3));
+    ensure("Full", !pc.trySend(std::move(p3)));
+    ensure("Not moved if not sent", !!p3);
+    ensure("Receive unique_ptr", pc.receive(p));
+    ensure_eq("Received value", *p, 42);
+
+    // SPSC order is preserved, throughput is measured by benchmarks
+    int const count = 10000;
+    {
+        mt::Channel<int> ch(64);
+        auto consumer = std::async(std::launch::async, [&ch]() {
+                int v, expected = 0;
+                while (ch.receive(v)) {
+                    if (v != expected++)
+                        return false;
+                }
+                return expected == count;
+            });
+        for (int i = 0; i < count; ++i)
+            ch.send(i);
+        ch.close();
+        ensure("SPSC order", consumer.get());
+    }
+
+    // MPMC: each item is received once
+    {
+        int const producers = 4, consumers = 4
+            , per_producer = count / producers;
+        mt::Channel<int> ch(64);
+        std::vector<std::future<std::vector<int> > > received;
+        for (int i = 0; i < consumers; ++i) {
+            received.push_back(std::async(std::launch::async, [&ch]() {
+                        std::vector<int> res;
+                        int v;
+                        while (ch.receive(v))
+                            res.push_back(v);
+                        return res;
+                    }));
+        }
+        std::vector<std::future<void> > sent;
+        for (int i = 0; i < producers; ++i) {
+            sent.push_back(std::async(std::launch::async, [&ch, i]() {
+                        for (int j = 0; j < per_producer; ++j)
+                            ch.send(i * per_producer + j);
+                    }));
+        }
+        for (auto &f : sent)
+            f.get();
+        ch.close();
+        std::vector<char> seen(producers * per_producer, 0);
+        size_t total = 0;
+        for (auto &f : received) {
+            for (auto v : f.get()) {
+                ensure("Item is received once", !seen[v]);
+                seen[v] = 1;
+                ++total;
+            }
+        }
+        ensure_eq("All items received", total, seen.size());
+    }
+
+    // select
+    mt::Channel<int> ints(4);
+    mt::Channel<QString> strs(4);
+    int int_sum = 0;
+    QStringList strings;
+    mt::Select select;
+    select.receive(ints, [&int_sum](int v) { int_sum += v; })
+        .receive(strs, [&strings](QString s) { strings.push_back(s); });
+    ensure_eq("Select timeout", select.wait(10), (int)mt::Select::Timeout);
+
+    auto producer = std::async(std::launch::async, [&ints, &strs]() {
+            for (int i = 1; i <= 10; ++i) {
+                ints.send(i);
+                strs.send(QString::number(i));
+            }
+            ints.close();
+            strs.close();
+        });
+    int res;
+    while ((res = select.wait(5000)) >= 0)
+        ensure("Case index", res < 2);
+    producer.get();
+    ensure_eq("Select result when closed", res, (int)mt::Select::Closed);
+    ensure_eq("Ints received", int_sum, 55);
+    ensure_eq("Strings received", strings.size(), 10);
+    ensure_eq("Strings order", strings.back(), QString("10"));
+}
+
+
+template<> template<>
+void object::test<tid_graph>()
+{
+    namespace mt = qtaround::mt;
+    typedef mt::TaskGraph::task_id task_id;
+
+    auto state_of = [](QVariantList const &stats, task_id i) {
+        return stats[i].toMap()["state"].toString();
+    };
+
+    std::mutex mutex;
+    QStringList order;
+    auto task = [&mutex, &order](QString const &name, int msec) {
+        return [&mutex, &order, name, msec]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+            std::lock_guard<std::mutex> l(mutex);
+            order.push_back(name);
+        };
+    };
+
+    mt::TaskGraph graph;
+    auto a = graph.add("a", task("a", 10));
+    auto b = graph.add("b", task("b", 100));
+    auto c = graph.add("c", task("c", 100));
+    auto d = graph.add("d", task("d", 0));
+    graph.depends(b, a);
+    graph.depends(c, a);
+    graph.depends(d, {b, c});
+    graph.run().get();
+    ensure_eq("All tasks executed", order.size(), 4);
+    ensure_eq("First task", order.front(), QString("a"));
+    ensure_eq("Final task", order.back(), QString("d"));
+    ensure_throws<qtaround::error::Error>("Can't run twice", [&graph]() {
+            graph.run();
+        });
+
+    auto stats = graph.stats();
+    ensure_eq("Stats for all tasks", stats.size(), 4);
+    for (task_id i = 0; i < 4; ++i)
+        ensure_eq("Task is done", state_of(stats, i), QString("done"));
+    auto b_info = stats[b].toMap(), c_info = stats[c].toMap()
+        , d_info = stats[d].toMap();
+    ensure_ge("Duration is recorded", b_info["duration_ms"].toDouble(), 100.0);
+    auto b_end = b_info["start_ms"].toDouble() + b_info["duration_ms"].toDouble();
+    ensure("Independent tasks overlap", c_info["start_ms"].toDouble() < b_end);
+    ensure_ge("Dependent task started after deps"
+              , d_info["start_ms"].toDouble(), b_end);
+
+    // failure cancels dependents only
+    mt::TaskGraph failing;
+    auto x = failing.add("x", []() {
+            qtaround::error::raise({{"msg", "x failed"}});
+        });
+    auto y = failing.add("y", []() {});
+    auto y2 = failing.add("y2", []() {});
+    auto z = failing.add("z", []() {});
+    failing.depends(y, x);
+    failing.depends(y2, y);
+    ensure_throws<qtaround::error::Error>("Graph should fail", [&failing]() {
+            failing.run().get();
+        });
+    stats = failing.stats();
+    ensure_eq("Failed task", state_of(stats, x), QString("failed"));
+    ensure_eq("Error is recorded", stats[x].toMap()["error"].toString()
+              , QString("x failed"));
+    ensure_eq("Dependent is canceled", state_of(stats, y), QString("canceled"));
+    ensure_eq("Cancel is propagated", state_of(stats, y2), QString("canceled"));
+    ensure_eq("Independent is done", state_of(stats, z), QString("done"));
+
+    // cycles are detected
+    mt::TaskGraph cycle;
+    auto c1 = cycle.add("c1", []() {});
+    auto c2 = cycle.add("c2", []() {});
+    cycle.depends(c1, c2);
+    cycle.depends(c2, c1);
+    ensure_throws<qtaround::error::Error>("Cycle", [&cycle]() { cycle.run(); });
+
+    // canceling result future cancels pending tasks
+    std::promise<void> gate;
+    auto gate_future = gate.get_future().share();
+    mt::TaskGraph canceled;
+    auto g1 = canceled.add("g1", [gate_future]() { gate_future.wait(); });
+    auto g2 = canceled.add("g2", []() {});
+    canceled.depends(g2, g1);
+    auto res = canceled.run();
+    res.cancel();
+    gate.set_value();
+    ensure_throws<qtaround::error::Error>("Canceled", [&res]() { res.get(); });
+    ensure_eq("Pending task is canceled", state_of(canceled.stats(), g2)
+              , QString("canceled"));
+}
+
+
+template<> template<>
+void object::test<tid_thread_options>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+
+    auto actor = mt::startActorSync<Test>
+        (make_test, nullptr, {{"name", "qtaround-test-actor"}
+            , {"cpus", QVariantList({0})}, {"nice", 5}, {"sched", "batch"}
+            , {"io_class", "best_effort"}, {"io_priority", 7}});
+    auto info = actor->ask<Test>([](Test *) {
+            QVariantMap res;
+            char name[32];
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+            res["name"] = QString(name);
+            cpu_set_t set;
+            sched_getaffinity(0, sizeof(set), &set);
+            res["cpus"] = CPU_COUNT(&set);
+            res["cpu0"] = !!CPU_ISSET(0, &set);
+            auto tid = (pid_t)::syscall(SYS_gettid);
+            res["nice"] = ::getpriority(PRIO_PROCESS, tid);
+            res["sched"] = sched_getscheduler(0);
+            res["ioprio"] = (int)::syscall(SYS_ioprio_get, 1, tid);
+            return res;
+        }).get();
+    ensure_eq("Name is truncated", info["name"].toString()
+              , QString("qtaround-test-a"));
+    ensure_eq("Single CPU", info["cpus"].toInt(), 1);
+    ensure("CPU 0", info["cpu0"].toBool());
+    ensure_eq("Nice", info["nice"].toInt(), 5);
+    ensure_eq("Policy", info["sched"].toInt(), (int)SCHED_BATCH);
+    ensure_eq("I/O priority", info["ioprio"].toInt(), (2 << 13) | 7);
+    ensure("Quit", actor->quitSync(5000));
+
+    auto start = [make_test](QVariantMap const &options) {
+        return [make_test, options]() {
+            mt::startActorSync<Test>(make_test, nullptr, options);
+        };
+    };
+    ensure_throws<qtaround::error::Error>
+        ("Unknown policy", start({{"sched", "fast"}}));
+    ensure_throws<qtaround::error::Error>
+        ("Wrong nice", start({{"nice", 100}}));
+    ensure_throws<qtaround::error::Error>
+        ("Wrong I/O priority", start({{"io_priority", 8}}));
+    ensure_throws<qtaround::error::Error>
+        ("Wrong CPU", start({{"cpus", "0,x"}}));
+    ensure_throws<qtaround::error::Error>
+        ("Thread options for pooled actor"
+         , start({{"pool", true}, {"name", "pooled"}}));
+}
+
+
+template<> template<>
+void object::test<tid_shm>()
+{
+    namespace mt = qtaround::mt;
+    namespace shm = qtaround::shm;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+
+    auto writer = shm::Ring::create(1000);
+    ensure_eq("Capacity", writer->capacity(), 4096u);
+    auto reader = shm::Ring::attach(writer->fds());
+    ensure_eq("Attached capacity", reader->capacity(), writer->capacity());
+
+    QByteArray data;
+    ensure("Empty ring", !reader->read(data, 0));
+    ensure("Read timeout", !reader->read(data, 10));
+    ensure_throws<qtaround::error::Error>("Message is too large", [&]() {
+            writer->write(QByteArray(writer->maxMessageSize() + 1, 'x'));
+        });
+    QByteArray big(writer->maxMessageSize(), 'x');
+    ensure("Write max size", writer->write(big, 0));
+    ensure("Ring is full", !writer->write(big, 10));
+    ensure("Read max size", reader->read(data, 0));
+    ensure_eq("Max size data", data, big);
+
+    // variable size messages are wrapped around the ring
+    int const count = 20000;
+    auto make_data = [](int i) {
+        return QByteArray(1 + (i * 7919) % 1500, (char)('a' + i % 26));
+    };
+    auto producer = std::async(std::launch::async, [&]() {
+            for (int i = 0; i < count; ++i)
+                writer->write(make_data(i));
+            writer->close();
+        });
+    int received = 0;
+    while (reader->read(data)) {
+        if (data != make_data(received))
+            break;
+        ++received;
+    }
+    producer.get();
+    ensure_eq("All messages received in order", received, count);
+    ensure("Ring is closed", reader->isClosed());
+    ensure("Write to closed ring", !writer->write(QByteArray("x")));
+
+    // peer corrupts the record length, it is not trusted
+    do {
+        auto ring = shm::Ring::create(4096);
+        ensure("Write", ring->write(QByteArray("x"), 0));
+        size_t const header_size = 4096;
+        auto size = header_size + ring->capacity();
+        auto mem = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED
+                          , ring->fds().memory, 0);
+        ensure("Mapped", mem != MAP_FAILED);
+        auto len = reinterpret_cast<quint32*>
+            (static_cast<char*>(mem) + header_size);
+        *len = ring->maxMessageSize();
+        ::munmap(mem, size);
+        ensure_throws<qtaround::error::Error>("Ring is corrupted", [&]() {
+                QByteArray data;
+                ring->read(data, 0);
+            });
+
+        // endpoint closes corrupted ring instead of crashing
+        auto actor = mt::startActorSync<Test>(make_test);
+        shm::ActorEndpoint endpoint(ring, actor);
+        endpoint.start();
+        endpoint.wait();
+        ensure("Corrupted ring is closed", ring->isClosed());
+    } while (0);
+
+    // another process writes to the ring
+    auto ring = shm::Ring::create(4096);
+    auto pid = ::fork();
+    if (!pid) {
+        for (int i = 0; i < 1000; ++i)
+            ring->write(reinterpret_cast<char const*>(&i), sizeof(i));
+        ring->close();
+        ::_exit(0);
+    }
+    int next = 0;
+    while (ring->read(data, 5000)) {
+        int v = -1;
+        if (data.size() == sizeof(v))
+            memcpy(&v, data.constData(), sizeof(v));
+        if (v != next)
+            break;
+        ++next;
+    }
+    int status = -1;
+    ::waitpid(pid, &status, 0);
+    ensure_eq("Child exit status", status, 0);
+    ensure_eq("Messages from child", next, 1000);
+
+    // remote actor messaging
+    auto actor = mt::startActorSync<Test>(make_test);
+    auto transport = shm::Ring::create(4096);
+    shm::RemoteActor remote(transport);
+    int sum = 0;
+    QByteArray text;
+    std::unique_ptr<shm::ActorEndpoint> endpoint
+        (new shm::ActorEndpoint(shm::Ring::attach(transport->fds()), actor));
+    endpoint->on<Test>("add", [&sum](Test *, QByteArray const &data) {
+            sum += data.toInt();
+        });
+    endpoint->on<Test>("text", [&text](Test *, QByteArray const &data) {
+            text += data;
+        });
+    endpoint->start();
+    for (int i = 1; i <= 1000; ++i) {
+        ensure("Post add", remote.post("add", QByteArray::number(i)));
+        ensure("Post text", remote.post("text", QByteArray::number(i % 10)));
+    }
+    ensure("Unknown key is dropped", remote.post("unknown", "x"));
+    remote.close();
+    endpoint->wait();
+    ensure("Processed", isProcessed(actor));
+    ensure_eq("Sum", sum, 500500);
+    ensure_eq("Text size", text.size(), 1000);
+    ensure_eq("Text order", text.left(11), QByteArray("12345678901"));
+    endpoint.reset();
+    ensure("Post to closed", !remote.post("add", "1"));
+}
+
+
+template<> template<>
+void object::test<tid_future>()
+{
+    namespace mt = qtaround::mt;
+    auto errorMessage = [](mt::Future<int> const &f) {
+        try {
+            f.get();
+        } catch (qtaround::error::Error const &e) {
+            return str(e.m["msg"]);
+        }
+        return QString();
+    };
+
+    mt::Future<int> f, next;
+    bool is_continued = false;
+    {
+        mt::Promise<int> p;
+        f = p.future();
+        next = f.then([&is_continued](mt::Future<int> f) {
+                is_continued = true;
+                return f.get();
+            });
+        auto copy = p;
+        ensure("Promise copy keeps future pending", !f.isReady());
+    }
+    ensure("Dropped promise resolves the future", f.isReady());
+    ensure_eq("Broken promise", errorMessage(f), QString("Broken promise"));
+    ensure("Continuation is executed", is_continued);
+    ensure_eq("Error is passed to continuation", errorMessage(next)
+              , QString("Broken promise"));
+
+    // chained continuations are released with the dropped promise
+    std::weak_ptr<int> alive;
+    {
+        mt::Promise<int> source;
+        auto marker = std::make_shared<int>(1);
+        alive = marker;
+        source.future().then([marker](mt::Future<int> f) {
+                return f.get();
+            }).then([](mt::Future<int> f) { return f.get(); });
+    }
+    ensure("Continuation is released", alive.expired());
+
+    mt::Promise<int> canceled;
+    auto chained = canceled.future().then([](mt::Future<int> f) {
+            return f.get();
+        });
+    chained.cancel();
+    ensure_eq("Cancel is propagated", errorMessage(canceled.future())
+              , QString("Canceled"));
+
+    auto timer = mt::after(10000);
+    timer.cancel();
+    ensure("Timer is canceled", timer.isReady());
+    try {
+        timer.get();
+        fail("Should raise");
+    } catch (qtaround::error::Error const &e) {
+        ensure_eq("Canceled timer", str(e.m["msg"]), QString("Canceled"));
+    }
+}
+
+
+template<> template<>
+void object::test<tid_undelivered>()
+{
+    namespace mt = qtaround::mt;
+    auto make_test = []() { return make_qobject_unique<Test>(); };
+
+    auto actor = mt::startActorSync<Test>(make_test, nullptr, {{"pool", true}});
+    std::atomic<int> delivered(0);
+    auto count = [&delivered](Test *) { ++delivered; };
+    do {
+        Gate gate;
+        gate.close(actor);
+        for (int i = 0; i < 3; ++i)
+            ensure("Posted before quit", actor->post<Test>(count));
+        actor->quit();
+        for (int i = 0; i < 5; ++i)
+            ensure("Posted after quit", actor->post<Test>(count));
+        // repeated request is not queued and counted
+        actor->quit();
+        gate.open();
+    } while (0);
+    ensure("Should quit", actor->quitSync(5000));
+    ensure_eq("Posted before quit are delivered", delivered.load(), 3);
+    ensure_eq("Undelivered are counted"
+              , actor->metrics()["undelivered"].toInt(), 5);
+    ensure("Post to finished", !actor->post<Test>(count));
+
+    // queued request of the finished actor fails instead of hanging
+    for (auto is_group : {false, true}) {
+        auto mode = is_group ? "group" : "actor";
+        std::unique_ptr<mt::ActorGroup> group;
+        if (is_group) {
+            group = mt::startActorGroup<Test>
+                (make_test, {{"size", 1}, {"pool", true}});
+            actor = group->shard(0);
+        } else {
+            actor = mt::startActorSync<Test>(make_test, nullptr, {{"pool", true}});
+        }
+        mt::Future<int> pending;
+        do {
+            Gate gate;
+            gate.close(actor);
+            actor->quit();
+            pending = is_group
+                ? group->ask<Test>("key", [](Test *) { return 1; })
+                : actor->ask<Test>([](Test *) { return 1; });
+            gate.open();
+        } while (0);
+        ensure(S_(mode, "Request is resolved"), pending.waitFor(5000));
+        try {
+            pending.get();
+            fail("Request should fail");
+        } catch (qtaround::error::Error const &e) {
+            ensure_eq(S_(mode, "Not running"), str(e.m["msg"])
+                      , QString("Actor is not running"));
+        }
+    }
+
+    actor = mt::startActorSync<Test>(make_test);
+    ensure("Should quit", actor->quitSync(5000));
+    ensure("Undelivered counter", actor->metrics().contains("undelivered"));
+    ensure("Post to finished thread actor", !actor->post<Test>(count));
+}
+
 }
 
 #include "mt.moc"
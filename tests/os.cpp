@@ -4,8 +4,13 @@
 #include <tut/tut.hpp>
 #include <cor/util.hpp>
 #include <cor/os.hpp>
+#include <QFile>
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QElapsedTimer>
 
 #include <atomic>
+#include <future>
 #include <sys/types.h>
 #include <sys/wait.h>
 
@@ -57,6 +62,16 @@ private:
 
 const QString RootDir::suffix = ".qtaround-test-f1f6f3868167b337dea6a229de1f3f4a";
 
+template <typename T>
+bool waitFuture(qtaround::mt::Future<T> const &f, int timeout = 10000)
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!f.isReady() && timer.elapsed() < timeout)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
+    return f.isReady();
+}
+
 }
 
 namespace tut
@@ -91,7 +106,12 @@ enum test_ids {
     tid_stat,
     tid_diskFree,
     tid_du,
-    tid_open_lock
+    tid_open_lock,
+    tid_fork_server,
+    tid_session,
+    tid_process_redirect,
+    tid_async,
+    tid_probe_cache
 };
 
 #define DQ "\""
@@ -576,4 +596,259 @@ void object::test<tid_open_lock>()
     }
 }
 
+template<> template<>
+void object::test<tid_fork_server>()
+{
+    namespace subprocess = qtaround::subprocess;
+    ensure("Should start fork server", subprocess::startForkServer());
+    auto stop = cor::on_scope_exit([]() { subprocess::stopForkServer(); });
+    ensure(AT, subprocess::isForkServerRunning());
+
+    auto out = subprocess::check_output("echo", {"a", "b"});
+    ensure_eq(AT, str(out), "a b\n");
+    ensure_eq(AT, subprocess::check_call("sh", {"-c", "exit 0"}), 0);
+    ensure_eq(AT, os::system("./subprocess_cmd_return_arg.sh", {"3", "5"}), 8);
+    ensure_throws<error::Error>(AT, []() {
+            subprocess::check_output("sh", {"-c", "echo err >&2; exit 3"});
+        });
+    ensure_throws<error::Error>(AT, []() {
+            subprocess::check_call("non-existing-cmd-f1f6f3868167", {});
+        });
+    try {
+        subprocess::check_call("sh", {"-c", "kill -9 $$"});
+        fail("Should raise");
+    } catch (error::Error const &e) {
+        ensure_eq("Crash info", e.m["info"], QVariant("Crashed"));
+        ensure_eq("Working directory", e.m["pwd"], QVariant(QDir::currentPath()));
+    }
+    // output larger than the pipe buffer
+    out = subprocess::check_output("dd", {"if=/dev/zero", "bs=1024", "count=256"});
+    ensure_eq(AT, out.size(), 256 * 1024);
+
+    subprocess::stopForkServer();
+    ensure(AT, !subprocess::isForkServerRunning());
+    // falls back to QProcess
+    ensure_eq(AT, str(subprocess::check_output("echo", {"c"})), "c\n");
+
+    auto started = std::async(std::launch::async, []() {
+            return subprocess::startForkServer();
+        });
+    ensure("Not started from other thread", !started.get());
+    ensure(AT, !subprocess::isForkServerRunning());
+}
+
+template<> template<>
+void object::test<tid_session>()
+{
+    namespace subprocess = qtaround::subprocess;
+    subprocess::Session session;
+    auto res = session.execute("echo", {"a b"});
+    ensure_eq(AT, res.rc, 0);
+    ensure_eq(AT, str(res.stdout), "a b\n");
+    ensure_eq(AT, str(res.stderr), "");
+    ensure(AT, session.isRunning());
+
+    res = session.execute("printf abc; echo err >&2; false");
+    ensure_eq(AT, res.rc, 1);
+    ensure_eq("No newline at the end", str(res.stdout), "abc");
+    ensure_eq(AT, str(res.stderr), "err\n");
+
+    session.execute("X=qtaround");
+    ensure_eq("State is kept", str(session.check_output("echo", {"$X"})), "$X\n");
+    ensure_eq("State is kept", str(session.execute("echo $X").stdout), "qtaround\n");
+
+    ensure_eq(AT, session.check_call("./subprocess_cmd_return_arg.sh", {"0", "0"}), 0);
+    ensure_throws<error::Error>(AT, [&session]() {
+            session.check_call("./subprocess_cmd_return_arg.sh", {"3", "5"});
+        });
+    do {
+        // session keeps running in the directory it was started in
+        auto cwd = QDir::currentPath();
+        auto restore = cor::on_scope_exit([cwd]() { QDir::setCurrent(cwd); });
+        QDir::setCurrent("/");
+        try {
+            session.check_call("false", {});
+            fail("Should raise");
+        } catch (error::Error const &e) {
+            ensure_eq("Session directory is reported", e.m["pwd"], QVariant(cwd));
+        }
+    } while (0);
+    ensure_throws<error::Error>(AT, [&session]() {
+            session.execute("sleep 5", 100);
+        });
+    ensure("Session is closed on timeout", !session.isRunning());
+    ensure_eq("Restarted", str(session.execute("echo $X").stdout), "\n");
+    session.close();
+    ensure(AT, !session.isRunning());
+}
+
+template<> template<>
+void object::test<tid_process_redirect>()
+{
+    namespace subprocess = qtaround::subprocess;
+    RootDir root{true};
+    auto src = os::path::join(root(), "src"), dst = os::path::join(root(), "dst");
+    QByteArray data("line1\nline2\n");
+    os::write_file(src, data);
+
+    subprocess::Process cat_files;
+    cat_files.setStdinFile(src);
+    cat_files.setStdoutFile(dst);
+    cat_files.start("cat", {});
+    cat_files.wait(-1);
+    ensure_eq(AT, cat_files.rc(), 0);
+    ensure_eq("Data is copied w/o parent", str(os::read_file(dst)), str(data));
+
+    QFile out(dst);
+    ensure(AT, out.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    subprocess::Process cat_fd;
+    cat_fd.setStdout(out.handle());
+    cat_fd.start("cat", {});
+    ensure(AT, cat_fd.write(data) == data.size());
+    cat_fd.stdinClose();
+    cat_fd.wait(-1);
+    out.close();
+    ensure_eq(AT, str(cat_fd.stdout()), "");
+    ensure_eq("Stdout is redirected to fd", str(os::read_file(dst)), str(data));
+
+    QFile in(src);
+    ensure(AT, in.open(QIODevice::ReadOnly));
+    subprocess::Process cat_dev;
+    cat_dev.start("cat", {});
+    ensure_eq(AT, cat_dev.write(in), data.size());
+    cat_dev.stdinClose();
+    cat_dev.wait(-1);
+    ensure_eq("Copied from QIODevice", str(cat_dev.stdout()), str(data));
+
+    subprocess::Process echo, tr;
+    echo.pipeTo(tr);
+    echo.start("echo", {"abc"});
+    tr.start("tr", {"a-z", "A-Z"});
+    echo.wait(-1);
+    tr.wait(-1);
+    ensure_eq("Piped", str(tr.stdout()), "ABC\n");
+}
+
+template<> template<>
+void object::test<tid_async>()
+{
+    namespace subprocess = qtaround::subprocess;
+    namespace mt = qtaround::mt;
+
+    auto run_all = [](char const *mode) {
+        QList<mt::Future<QByteArray> > outputs;
+        for (int i = 0; i < 5; ++i)
+            outputs.push_back(subprocess::check_output_async
+                              ("sh", {"-c", str("sleep 0.2; echo ", i)}));
+        for (int i = 0; i < outputs.size(); ++i) {
+            ensure(S_(mode, "output", str(i)), waitFuture(outputs[i]));
+            ensure_eq(S_(mode, "output", str(i)), str(outputs[i].get()), str(i, "\n"));
+        }
+
+        auto res = subprocess::run_async("sh", {"-c", "echo err >&2; exit 3"});
+        ensure(AT, waitFuture(res));
+        ensure_eq(mode, res.get().rc, 3);
+        ensure_eq(mode, str(res.get().stderr), "err\n");
+
+        auto failed = subprocess::check_call_async("sh", {"-c", "exit 2"});
+        ensure(AT, waitFuture(failed));
+        ensure_throws<error::Error>(mode, [&failed]() { failed.get(); });
+
+        auto timeout = subprocess::run_async("sleep", {"5"}, {{"timeout", 100}});
+        ensure(AT, waitFuture(timeout, 2000));
+        ensure_throws<error::Error>(mode, [&timeout]() { timeout.get(); });
+
+        auto canceled = subprocess::run_async("sleep", {"5"});
+        ensure(AT, canceled.cancel());
+        ensure(AT, waitFuture(canceled, 100));
+        ensure_throws<error::Error>(mode, [&canceled]() { canceled.get(); });
+
+        auto rc = os::system_async("./subprocess_cmd_return_arg.sh", {"3", "5"});
+        ensure(AT, waitFuture(rc));
+        ensure_eq(mode, rc.get(), 8);
+    };
+    run_all("QProcess");
+
+    ensure(AT, subprocess::startForkServer());
+    auto stop = cor::on_scope_exit([]() { subprocess::stopForkServer(); });
+    run_all("Fork server");
+    auto res = subprocess::run_async("true", {});
+    ensure(AT, waitFuture(res));
+    ensure_ne("Resource usage is filled", res.get().usage.ru_maxrss, 0);
+}
+
+template<> template<>
+void object::test<tid_probe_cache>()
+{
+    namespace subprocess = qtaround::subprocess;
+    auto &cache = subprocess::Cache::instance();
+    auto restore = cor::on_scope_exit([&cache]() {
+            cache.setTtl(1000);
+            cache.invalidate();
+        });
+    auto now = []() {
+        return subprocess::Cache::instance().check_output("date", {"+%s%N"});
+    };
+
+    auto v1 = subprocess::check_output("date", {"+%s%N"});
+    ::usleep(1000);
+    ensure_ne("Not cached without opt-in", v1, now());
+
+    cache.setTtl(60 * 1000);
+    cache.invalidate();
+    cache.resetStats();
+    v1 = now();
+    ensure_eq("Cached", v1, now());
+    auto stats = cache.stats();
+    ensure_eq(AT, stats["misses"].toInt(), 1);
+    ensure_eq(AT, stats["hits"].toInt(), 1);
+
+    cache.invalidate("date");
+    ensure_ne("Invalidated", v1, now());
+
+    cache.setTtl(10);
+    v1 = now();
+    ::usleep(20 * 1000);
+    ensure_ne("Expired", v1, now());
+    ensure_ge(AT, cache.stats()["expired"].toInt(), 1);
+
+    cache.setTtl(60 * 1000);
+    cache.invalidate();
+    cache.resetStats();
+    ensure_ne(AT, cache.run("false", {}).rc, 0);
+    ensure_ne(AT, cache.run("false", {}).rc, 0);
+    ensure_eq("Failed command is not cached", cache.stats()["misses"].toInt(), 2);
+    ensure_eq(AT, cache.stats()["size"].toInt(), 0);
+
+    cache.invalidate();
+    cache.resetStats();
+    auto free1 = os::diskFree(os::home());
+    auto misses = cache.stats()["misses"].toInt();
+    ensure_ge("Mount point probe is executed", misses, 1);
+    os::diskFree(os::home());
+    ensure_eq("Mount point probe is cached", cache.stats()["misses"].toInt(), misses);
+    ensure_ge(AT, cache.stats()["hits"].toInt(), misses);
+    ensure_ge(AT, free1, 0.0);
+
+    cache.invalidate();
+    cache.resetStats();
+    static const int max_size = 256;
+    for (int i = 0; i < max_size; ++i) {
+        cache.run("true", {QString::number(i)});
+        if (i == max_size / 2)
+            cache.run("true", {"0"});
+    }
+    ensure_eq(AT, cache.stats()["size"].toInt(), max_size);
+    cache.run("true", {"0"});
+    cache.run("true", {QString::number(max_size)});
+    ensure_eq("Only one entry is evicted", cache.stats()["size"].toInt(), max_size);
+    cache.resetStats();
+    cache.run("true", {"0"});
+    ensure_eq("Recently used entry is kept", cache.stats()["hits"].toInt(), 1);
+    cache.run("true", {"1"});
+    ensure_eq("Least recently used entry is evicted"
+              , cache.stats()["misses"].toInt(), 1);
+}
+}
+
 }
@@ -2,6 +2,8 @@
 #define _VAULT_TESTS_COMMON_HPP_
 
 #include <QStringList>
+#include <QDebug>
+#include <QVariant>
 
 #define STRINGIFY(x) #x
 #define TOSTRING(x) STRINGIFY(x)
@@ -35,6 +37,42 @@ std::basic_ostream<CharT>& operator <<
     return dst;
 }
 
+template <class CharT>
+std::basic_ostream<CharT>& operator <<
+(std::basic_ostream<CharT> &dst, QByteArray const &src)
+{
+    dst << std::string(src.constData(), src.size());
+    return dst;
+}
+
+template <class CharT>
+std::basic_ostream<CharT>& operator <<
+(std::basic_ostream<CharT> &dst, QVariant const &src)
+{
+    QString s;
+    QDebug(&s) << src;
+    dst << s.toStdString();
+    return dst;
+}
+
+template <class CharT, class T>
+std::basic_ostream<CharT>& operator <<
+(std::basic_ostream<CharT> &dst, QList<T> const &src)
+{
+    for (auto const &v : src)
+        dst << v << ",";
+    return dst;
+}
+
+template <class CharT, class K, class V>
+std::basic_ostream<CharT>& operator <<
+(std::basic_ostream<CharT> &dst, QMap<K, V> const &src)
+{
+    for (auto it = src.begin(); it != src.end(); ++it)
+        dst << it.key() << ":" << it.value() << ",";
+    return dst;
+}
+
 QStringList strings()
 {
     return QStringList();